@@ -0,0 +1,31 @@
+/*
+ * include/sheep/array.h
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#ifndef _SHEEP_ARRAY_H
+#define _SHEEP_ARRAY_H
+
+#include <sheep/object.h>
+#include <sheep/vector.h>
+
+struct sheep_vm;
+
+/*
+ * Vectors of the language.  They are arrays in here, to keep them
+ * apart from struct sheep_vector, which stores their items.
+ */
+extern const struct sheep_type sheep_array_type;
+
+static inline struct sheep_vector *sheep_array(sheep_t sheep)
+{
+	return sheep_inline_data(sheep);
+}
+
+sheep_t sheep_make_array(struct sheep_vm *, unsigned long, sheep_t *);
+void sheep_array_push(struct sheep_vm *, sheep_t, sheep_t);
+int sheep_array_set(struct sheep_vm *, sheep_t, long, sheep_t);
+
+void sheep_array_builtins(struct sheep_vm *);
+
+#endif /* _SHEEP_ARRAY_H */
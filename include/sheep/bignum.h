@@ -0,0 +1,53 @@
+/*
+ * include/sheep/bignum.h
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#ifndef _SHEEP_BIGNUM_H
+#define _SHEEP_BIGNUM_H
+
+#include <sheep/object.h>
+#include <stdint.h>
+
+struct sheep_vm;
+
+/*
+ * Integers outside the fixnum range.  The magnitude is stored with
+ * the least significant digit first and without leading zeroes, and
+ * integers that fit a fixnum are never bignums.
+ */
+struct sheep_bignum {
+	int negative;
+	unsigned int nr_digits;
+	uint32_t *digits;
+};
+
+extern const struct sheep_type sheep_bignum_type;
+
+static inline struct sheep_bignum *sheep_bignum(sheep_t sheep)
+{
+	return sheep_inline_data(sheep);
+}
+
+/* Whether @sheep is a fixnum or a bignum */
+static inline int sheep_is_integer(sheep_t sheep)
+{
+	return sheep_type(sheep) == &sheep_number_type ||
+		sheep_type(sheep) == &sheep_bignum_type;
+}
+
+sheep_t sheep_bignum_from_long(struct sheep_vm *, long);
+int sheep_parse_bignum(struct sheep_vm *, const char *, sheep_t *);
+
+/* Arithmetic on integers, the results are fixnums where possible */
+sheep_t sheep_bignum_add(struct sheep_vm *, sheep_t, sheep_t);
+sheep_t sheep_bignum_sub(struct sheep_vm *, sheep_t, sheep_t);
+sheep_t sheep_bignum_mul(struct sheep_vm *, sheep_t, sheep_t);
+int sheep_bignum_divmod(struct sheep_vm *, sheep_t, sheep_t,
+			sheep_t *, sheep_t *);
+sheep_t sheep_bignum_shl(struct sheep_vm *, sheep_t, unsigned int);
+sheep_t sheep_bignum_neg(struct sheep_vm *, sheep_t);
+int sheep_bignum_cmp(sheep_t, sheep_t);
+double sheep_bignum_double(sheep_t);
+
+#endif /* _SHEEP_BIGNUM_H */
@@ -0,0 +1,47 @@
+/*
+ * include/sheep/bytecode.h
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#ifndef _SHEEP_BYTECODE_H
+#define _SHEEP_BYTECODE_H
+
+#include <sheep/module.h>
+#include <sheep/object.h>
+#include <sheep/vm.h>
+#include <stddef.h>
+
+/*
+ * Compiled modules are cached in a .sheepc file next to their
+ * source, see sheep/bytecode.c for the format.
+ */
+struct sheep_bytecode {
+	char *bytes;
+	size_t nr_bytes;
+	size_t size;
+	unsigned int nr_forms;
+	const char **builtins;	/* slot -> name */
+	unsigned int nr_builtins;
+	int failed;
+};
+
+void sheep_bytecode_init(struct sheep_bytecode *, struct sheep_vm *);
+void sheep_bytecode_add(struct sheep_bytecode *,
+			struct sheep_vm *,
+			struct sheep_module *,
+			unsigned long,
+			sheep_t);
+int sheep_bytecode_write(struct sheep_bytecode *,
+			 const char *,
+			 unsigned long,
+			 size_t);
+void sheep_bytecode_exit(struct sheep_bytecode *);
+
+sheep_t sheep_bytecode_load(struct sheep_vm *,
+			    struct sheep_module *,
+			    const char *,
+			    const char *,
+			    unsigned long,
+			    size_t);
+
+#endif /* _SHEEP_BYTECODE_H */
@@ -32,20 +32,60 @@ enum sheep_opcode {
 	/*15*/SHEEP_BRF,
 	/*16*/SHEEP_BR,
 	/*17*/SHEEP_LOAD,
+	/* Inlined builtins, the argument is the builtin's global slot */
+	/*18*/SHEEP_ADD,
+	/*19*/SHEEP_SUB,
+	/*20*/SHEEP_MUL,
+	/*21*/SHEEP_LT,
+	/*22*/SHEEP_LE,
+	/*23*/SHEEP_EQ,
+	/* Superinstructions, only created by sheep_code_finalize() */
+	/*24*/SHEEP_LOCAL_LOCAL,
+	/*25*/SHEEP_SET_LOCAL_POP,
+	/*26*/SHEEP_CALL_GLOBAL,
+	/*27*/SHEEP_TAILCALL_GLOBAL,
+	/*28*/SHEEP_BRF_DROP,
 };
 
 #define SHEEP_OPCODE_BITS	5
 #define SHEEP_OPCODE_SHIFT	(sizeof(long) * 8 - SHEEP_OPCODE_BITS)
 
+/* Pre-decoded instruction, see sheep_code_finalize() */
+struct sheep_insn {
+	const void *handler;
+	enum sheep_opcode op;
+	unsigned int arg;
+};
+
+/*
+ * Inline cache of a HASH or SET_HASH instruction, whose argument is
+ * the index of its cache after sheep_code_finalize().  It remembers
+ * the slot the key resolved to in the last module or typeclass seen:
+ * a global slot or an index into the values of a typeobject.
+ */
+struct sheep_cache {
+	unsigned int key;	/* key slot */
+	unsigned long id;	/* module or class id, 0 if empty */
+	unsigned int slot;
+};
+
+unsigned long sheep_cache_id(void);
+
 struct sheep_code {
 	struct sheep_vector code;
 	struct sheep_vector labels;
+	struct sheep_vector lines;	/* [offset line]... */
+	struct sheep_insn *insns;
+	struct sheep_cache *caches;
 };
 
 static inline void sheep_code_exit(struct sheep_code *code)
 {
 	sheep_free(code->code.items);
 	sheep_free(code->labels.items);
+	sheep_free(code->lines.items);
+	sheep_free(code->insns);
+	sheep_free(code->caches);
 }
 
 static inline unsigned long sheep_encode(enum sheep_opcode op, unsigned int arg)
@@ -74,7 +114,10 @@ static inline unsigned long sheep_emit(struct sheep_code *code,
 
 unsigned long sheep_code_jump(struct sheep_code *);
 void sheep_code_label(struct sheep_code *, unsigned long);
+unsigned long sheep_code_line(struct sheep_code *, unsigned long);
+unsigned long sheep_code_lineno(struct sheep_code *, unsigned long);
 void sheep_code_finalize(struct sheep_code *);
+int sheep_code_analyze(struct sheep_code *, unsigned int, unsigned int *);
 
 void sheep_code_dump(struct sheep_vm *,
 		     struct sheep_function *,
@@ -70,6 +70,10 @@ int sheep_compile_list(struct sheep_compile *,
 		       struct sheep_function *,
 		       struct sheep_context *,
 		       sheep_t);
+int sheep_compile_array(struct sheep_compile *,
+			struct sheep_function *,
+			struct sheep_context *,
+			sheep_t);
 
 void sheep_propagate_foreigns(struct sheep_function *, struct sheep_function *);
 
@@ -7,6 +7,7 @@
 #define _SHEEP_EVAL_H
 
 #include <sheep/object.h>
+#include <sheep/code.h>
 #include <sheep/list.h>
 #include <sheep/vm.h>
 #include <stdarg.h>
@@ -15,6 +16,8 @@ sheep_t sheep_eval(struct sheep_vm *, sheep_t);
 sheep_t sheep_apply(struct sheep_vm *, sheep_t, struct sheep_list *);
 sheep_t sheep_call(struct sheep_vm *, sheep_t, unsigned int, ...);
 
+const void *sheep_eval_handler(enum sheep_opcode);
+
 void sheep_evaluator_exit(struct sheep_vm *);
 
 #endif /* _SHEEP_EVAL_H */
@@ -0,0 +1,57 @@
+/*
+ * include/sheep/flonum.h
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#ifndef _SHEEP_FLONUM_H
+#define _SHEEP_FLONUM_H
+
+#include <sheep/bignum.h>
+#include <sheep/number.h>
+#include <sheep/object.h>
+#include <stdint.h>
+#include <string.h>
+
+struct sheep_vm;
+
+/* Flonums that can not be encoded immediately */
+struct sheep_flonum {
+	double value;
+};
+
+/* Exponent bias of immediate flonums, see sheep_make_flonum() */
+#define SHEEP_FLONUM_BIAS	((uint64_t)896 << 53)
+
+static inline double sheep_flonum(sheep_t sheep)
+{
+	struct sheep_flonum *flonum;
+	uint64_t bits;
+	double value;
+
+	if (!sheep_is_immediate(sheep)) {
+		flonum = sheep_inline_data(sheep);
+		return flonum->value;
+	}
+	bits = (unsigned long)sheep >> 3;
+	if (bits > 1)
+		bits += SHEEP_FLONUM_BIAS;
+	bits = (bits >> 1) | (bits << 63);
+	memcpy(&value, &bits, sizeof(double));
+	return value;
+}
+
+static inline int sheep_is_flonum(sheep_t sheep)
+{
+	return sheep_type(sheep) == &sheep_flonum_type;
+}
+
+static inline int sheep_is_number(sheep_t sheep)
+{
+	return sheep_is_integer(sheep) || sheep_is_flonum(sheep);
+}
+
+sheep_t sheep_make_flonum(struct sheep_vm *, double);
+int sheep_parse_flonum(struct sheep_vm *, const char *, sheep_t *);
+double sheep_number_double(sheep_t);
+
+#endif /* _SHEEP_FLONUM_H */
@@ -15,8 +15,10 @@ struct sheep_vm;
 struct sheep_function {
 	struct sheep_code code;
 	unsigned int nr_locals;
+	unsigned int max_stack;
 
 	const char *name;
+	const char *filename;
 	unsigned int nr_parms;
 	struct sheep_vector *foreign;
 };
@@ -31,6 +33,7 @@ static inline struct sheep_function *sheep_function(sheep_t sheep)
 
 sheep_t sheep_make_function(struct sheep_vm *, const char *);
 sheep_t sheep_closure_function(struct sheep_vm *, struct sheep_function *);
+void sheep_function_finalize(struct sheep_function *);
 
 static inline unsigned int sheep_function_local(struct sheep_function *function)
 {
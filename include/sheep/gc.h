@@ -6,16 +6,75 @@
 #ifndef _SHEEP_GC_H
 #define _SHEEP_GC_H
 
+#include <sheep/vector.h>
 #include <sheep/types.h>
 
 struct sheep_vm;
 
-struct sheep_object *sheep_gc_alloc(struct sheep_vm *);
+/* Number of object size classes, see gc.c */
+#define SHEEP_GC_CLASSES	6
+
+/* Largest payload that can be stored inline with an object */
+#define SHEEP_INLINE_MAX	(128 - sizeof(struct sheep_object))
+
+/*
+ * Collector tuning, sizes are in pools.  The defaults are set by
+ * sheep_gc_init() and may be changed by the embedder at any time.
+ * From code, (gc-config setting &optional value) accesses them as
+ * "nursery", "min-heap", "live-ratio", "chunk" and "reserve".
+ */
+struct sheep_gc_config {
+	unsigned int nursery_pools;	/* allocated between collections */
+	unsigned int min_heap_pools;	/* no major collections below */
+	unsigned int live_ratio;	/* target live/heap percentage */
+	unsigned int chunk_pools;	/* mapped at once, at least 1 */
+	unsigned int reserve_pools;	/* unused ones kept mapped */
+};
+
+/* Per-type object counts, see (gc-stats) */
+struct sheep_gc_typestats {
+	const struct sheep_type *type;
+	unsigned long nr_freed;
+	unsigned long nr_present;	/* counted on demand */
+};
+
+/* Collector statistics, times are in nanoseconds */
+struct sheep_gc_stats {
+	unsigned long nr_minor;
+	unsigned long nr_major;
+	unsigned long nr_allocated;
+	unsigned long nr_freed;
+	unsigned long nr_mapped;	/* pools */
+	unsigned long nr_unmapped;
+	unsigned long pause_total;
+	unsigned long pause_max;
+	struct sheep_vector types;	/* struct sheep_gc_typestats */
+};
+
+struct sheep_object *__sheep_gc_alloc(struct sheep_vm *, size_t);
+
+static inline struct sheep_object *sheep_gc_alloc(struct sheep_vm *vm)
+{
+	return __sheep_gc_alloc(vm, 0);
+}
 
 void sheep_mark(sheep_t);
+
+/*
+ * Storing a reference into an object that already exists must be
+ * followed by a write barrier, so that minor collections can find
+ * young objects that are referenced only by old ones.  Stores into
+ * places other than objects that are not scanned as roots use
+ * sheep_remember() on the stored value.
+ */
+void sheep_write_barrier(struct sheep_vm *, sheep_t, sheep_t);
+void sheep_remember(struct sheep_vm *, sheep_t);
+
 void sheep_protect(struct sheep_vm *, sheep_t);
 void sheep_unprotect(struct sheep_vm *, sheep_t);
 
+void sheep_gc_init(struct sheep_vm *);
+void sheep_gc_builtins(struct sheep_vm *);
 void sheep_gc_exit(struct sheep_vm *);
 
 #endif /* _SHEEP_GC_H */
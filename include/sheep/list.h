@@ -20,14 +20,13 @@ extern const struct sheep_type sheep_list_type;
 
 sheep_t sheep_make_cons(struct sheep_vm *, sheep_t, sheep_t);
 sheep_t sheep_make_list(struct sheep_vm *, unsigned int, ...);
+sheep_t sheep_list_append(struct sheep_vm *, sheep_t, sheep_t);
 
 static inline struct sheep_list *sheep_list(sheep_t sheep)
 {
-	return sheep_data(sheep);
+	return sheep_inline_data(sheep);
 }
 
-int sheep_list_search(struct sheep_list *, sheep_t, size_t *);
-
 void sheep_list_builtins(struct sheep_vm *);
 
 #endif /* _SHEEP_LIST_H */
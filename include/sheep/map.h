@@ -6,19 +6,35 @@
 #ifndef _SHEEP_MAP_H
 #define _SHEEP_MAP_H
 
-#define SHEEP_MAP_SIZE		64
+/* Entries in the table embedded in the map, before it is grown */
+#define SHEEP_MAP_INLINE	8
 
-struct sheep_map_entry;
+struct sheep_map_entry {
+	const char *name;
+	void *value;
+};
+
+/*
+ * The keys are compared and hashed by identity, they are usually
+ * interned strings, see sheep_intern().  Some maps use the addresses
+ * of objects as keys, like struct sheep_expr.
+ */
 struct sheep_map {
-	struct sheep_map_entry *entries[SHEEP_MAP_SIZE];
+	unsigned int nr_entries;
+	unsigned int size;		/* 0 while the inline table is used */
+	struct sheep_map_entry *entries;
+	struct sheep_map_entry inline_entries[SHEEP_MAP_INLINE];
 };
 
 #define SHEEP_DEFINE_MAP(name)			\
-	struct sheep_map name = { { 0 } }
+	struct sheep_map name = { 0 }
 
 int sheep_map_set(struct sheep_map *, const char *, void *);
 int sheep_map_get(struct sheep_map *, const char *, void **);
 int sheep_map_del(struct sheep_map *, const char *);
+void sheep_map_each(struct sheep_map *,
+		    void (*)(const char *, void *, void *),
+		    void *);
 
 void sheep_map_drain(struct sheep_map *);
 
@@ -7,6 +7,7 @@
 #define _SHEEP_MODULE_H
 
 #include <sheep/object.h>
+#include <sheep/vector.h>
 #include <sheep/alien.h>
 #include <sheep/map.h>
 
@@ -15,13 +16,24 @@ struct sheep_vm;
 struct sheep_module {
 	const char *name;
 	struct sheep_map env;
+	struct sheep_vector globals;	/* [slot name]..., in slot order */
 	void *handle;
+	unsigned long id;	/* unique, for inline caches */
 };
 
 extern const struct sheep_type sheep_module_type;
 
 sheep_t sheep_module_load(struct sheep_vm *, const char *);
 
+/* Record global @slot, bound to @name, as owned by @module */
+static inline void sheep_module_global(struct sheep_module *module,
+				       unsigned int slot,
+				       const char *name)
+{
+	sheep_vector_push(&module->globals, (void *)(unsigned long)slot);
+	sheep_vector_push(&module->globals, (void *)name);
+}
+
 unsigned int sheep_module_variable(struct sheep_vm *,
 				   struct sheep_module *,
 				   const char *,
@@ -7,7 +7,24 @@
 #define _SHEEP_NAME_H
 
 #include <sheep/object.h>
+#include <stddef.h>
 
+/*
+ * Interned strings.  Name parts, map keys and the key slots of the
+ * VM are interned, so that they compare by pointer.  The strings
+ * live as long as the VM.
+ */
+struct sheep_symbols {
+	char **table;
+	unsigned int nr_symbols;
+	unsigned int size;		/* power of two */
+};
+
+const char *__sheep_intern(struct sheep_vm *, const char *, size_t);
+const char *sheep_intern(struct sheep_vm *, const char *);
+void sheep_symbols_exit(struct sheep_vm *);
+
+/* The parts are interned */
 struct sheep_name {
 	const char **parts;
 	unsigned int nr_parts;
@@ -19,7 +36,7 @@ sheep_t sheep_make_name(struct sheep_vm *, const char *);
 
 static inline struct sheep_name *sheep_name(sheep_t sheep)
 {
-	return sheep_data(sheep);
+	return sheep_inline_data(sheep);
 }
 
 #endif /* _SHEEP_NAME_H */
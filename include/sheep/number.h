@@ -7,20 +7,76 @@
 #define _SHEEP_NUMBER_H
 
 #include <sheep/types.h>
+#include <limits.h>
 
 struct sheep_vm;
 
+#define SHEEP_FIXNUM_MIN	(LONG_MIN >> 1)
+#define SHEEP_FIXNUM_MAX	(LONG_MAX >> 1)
+
+/*
+ * Objects are at least 8-byte aligned, the low bits of a reference
+ * tag immediate values instead:
+ *
+ *   xx1  fixnum
+ *   010  flonum, see sheep/flonum.c
+ *   000  object
+ */
+#define SHEEP_FLONUM_TAG	2
+
 static inline int sheep_is_fixnum(sheep_t sheep)
 {
 	return (long)sheep & 1;
 }
 
+/* Whether @sheep is a tagged value and not an object reference */
+static inline int sheep_is_immediate(sheep_t sheep)
+{
+	return (long)sheep & 3;
+}
+
 static inline long sheep_fixnum(sheep_t sheep)
 {
 	return (long)sheep >> 1;
 }
 
+/*
+ * Fixnum arithmetic on the tagged representation, which overflows
+ * exactly when the result does not fit a fixnum.  They return
+ * nonzero on overflow.
+ */
+static inline int sheep_fixnum_add(sheep_t a, sheep_t b, sheep_t *result)
+{
+	long sum;
+
+	if (__builtin_add_overflow((long)a, (long)b - 1, &sum))
+		return 1;
+	*result = (sheep_t)sum;
+	return 0;
+}
+
+static inline int sheep_fixnum_sub(sheep_t a, sheep_t b, sheep_t *result)
+{
+	long difference;
+
+	if (__builtin_sub_overflow((long)a, (long)b - 1, &difference))
+		return 1;
+	*result = (sheep_t)difference;
+	return 0;
+}
+
+static inline int sheep_fixnum_mul(sheep_t a, sheep_t b, sheep_t *result)
+{
+	long product;
+
+	if (__builtin_mul_overflow(sheep_fixnum(a), (long)b - 1, &product))
+		return 1;
+	*result = (sheep_t)(product + 1);
+	return 0;
+}
+
 extern const struct sheep_type sheep_number_type;
+extern const struct sheep_type sheep_flonum_type;
 
 sheep_t sheep_make_number(struct sheep_vm *, long);
 int sheep_parse_number(struct sheep_vm *, const char *, sheep_t *);
@@ -10,17 +10,27 @@
 #include <sheep/types.h>
 
 sheep_t sheep_make_object(struct sheep_vm *, const struct sheep_type *, void *);
+sheep_t __sheep_make_object(struct sheep_vm *, const struct sheep_type *, size_t);
 
 static inline const struct sheep_type *sheep_type(sheep_t sheep)
 {
-	if (sheep_is_fixnum(sheep))
-		return &sheep_number_type;
+	if (sheep_is_immediate(sheep)) {
+		if (sheep_is_fixnum(sheep))
+			return &sheep_number_type;
+		return &sheep_flonum_type;
+	}
 	return sheep->type;
 }
 
 static inline void *sheep_data(sheep_t sheep)
 {
-	return (void *)(sheep->data & ~1);
+	return (void *)sheep->data;
+}
+
+/* Payload of an object allocated by __sheep_make_object() */
+static inline void *sheep_inline_data(sheep_t sheep)
+{
+	return sheep + 1;
 }
 
 int sheep_test(sheep_t);
@@ -8,13 +8,23 @@
 
 #include <sheep/object.h>
 #include <sheep/vector.h>
+#include <sheep/map.h>
 #include <sheep/vm.h>
 #include <stdio.h>
 
+/*
+ * A reader either streams from @file, which keeps interactive input
+ * working, or scans the memory between @pos and @end.
+ */
 struct sheep_reader {
 	const char *filename;
 	unsigned long lineno;
 	FILE *file;
+	const char *pos;
+	const char *end;
+	char *data;
+	size_t size;
+	int mapped;
 };
 
 static inline void sheep_reader_init(struct sheep_reader *reader,
@@ -24,16 +34,34 @@ static inline void sheep_reader_init(struct sheep_reader *reader,
 	reader->filename = filename;
 	reader->lineno = 1;
 	reader->file = file;
+	reader->pos = reader->end = NULL;
+	reader->data = NULL;
+	reader->size = 0;
+	reader->mapped = 0;
 }
 
+static inline void sheep_reader_init_buffer(struct sheep_reader *reader,
+					    const char *filename,
+					    const char *buf,
+					    size_t len)
+{
+	sheep_reader_init(reader, filename, NULL);
+	reader->pos = buf;
+	reader->end = buf + len;
+}
+
+int sheep_reader_open(struct sheep_reader *, const char *);
+void sheep_reader_close(struct sheep_reader *);
+
 struct sheep_expr {
 	sheep_t object;
-	const char *filename;
-	struct sheep_vector lines;
+	const char *filename;		/* interned */
+	struct sheep_map locations;	/* object identity -> line */
 };
 
 extern struct sheep_object sheep_eof;
 
+unsigned long sheep_expr_line(struct sheep_expr *, sheep_t);
 void sheep_free_expr(struct sheep_expr *);
 struct sheep_expr *sheep_read(struct sheep_reader *, struct sheep_vm *);
 
@@ -20,11 +20,12 @@ struct sheep_string {
 extern const struct sheep_type sheep_string_type;
 
 sheep_t __sheep_make_string(struct sheep_vm *, const char *, size_t);
+sheep_t sheep_copy_string(struct sheep_vm *, const char *, size_t);
 sheep_t sheep_make_string(struct sheep_vm *, const char *);
 
 static inline struct sheep_string *sheep_string(sheep_t sheep)
 {
-	return sheep_data(sheep);
+	return sheep_inline_data(sheep);
 }
 
 static inline const char *sheep_rawstring(sheep_t sheep)
@@ -0,0 +1,41 @@
+/*
+ * include/sheep/table.h
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#ifndef _SHEEP_TABLE_H
+#define _SHEEP_TABLE_H
+
+#include <sheep/object.h>
+
+struct sheep_vm;
+
+struct sheep_table_entry {
+	sheep_t key;			/* NULL if unused */
+	sheep_t value;
+	unsigned long hash;
+};
+
+/* Hash tables, their keys are compared with sheep_equal() */
+struct sheep_table {
+	unsigned int nr_entries;
+	unsigned int size;		/* power of two, or 0 */
+	struct sheep_table_entry *entries;
+};
+
+extern const struct sheep_type sheep_table_type;
+
+static inline struct sheep_table *sheep_table(sheep_t sheep)
+{
+	return sheep_inline_data(sheep);
+}
+
+sheep_t sheep_make_table(struct sheep_vm *);
+
+int sheep_table_get(struct sheep_vm *, sheep_t, sheep_t, sheep_t *);
+int sheep_table_set(struct sheep_vm *, sheep_t, sheep_t, sheep_t);
+int sheep_table_del(struct sheep_vm *, sheep_t, sheep_t);
+
+void sheep_table_builtins(struct sheep_vm *);
+
+#endif /* _SHEEP_TABLE_H */
@@ -11,10 +11,13 @@
 
 struct sheep_vm;
 
+/*
+ * Instances only carry their values, the slot names are resolved
+ * through the class.  Small value arrays are stored inline.
+ */
 struct sheep_typeobject {
 	sheep_t class;
 	sheep_t *values;
-	struct sheep_map map;
 };
 
 extern const struct sheep_type sheep_typeobject_type;
@@ -23,6 +26,8 @@ struct sheep_typeclass {
 	const char *name;
 	const char **names;
 	unsigned int nr_slots;
+	struct sheep_map slots;	/* name -> value index */
+	unsigned long id;	/* unique, for inline caches */
 };
 
 extern const struct sheep_type sheep_typeclass_type;
@@ -49,6 +49,8 @@ struct sheep_type {
 
 	int (*test)(sheep_t);
 	int (*equal)(sheep_t, sheep_t);
+	/* Required for table keys of types with equal() */
+	unsigned long (*hash)(sheep_t);
 
 	void (*format)(sheep_t, struct sheep_strbuf *, int);
 
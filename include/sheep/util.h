@@ -21,6 +21,8 @@ void *sheep_realloc(void *, size_t);
 char *sheep_strdup(const char *);
 void sheep_free(const void *);
 
+unsigned long sheep_hash(const void *, size_t);
+
 struct sheep_strbuf {
 	char *bytes;
 	size_t nr_bytes;
@@ -14,6 +14,7 @@ struct sheep_vector {
 
 unsigned long sheep_vector_push(struct sheep_vector *, void *);
 void sheep_vector_grow(struct sheep_vector *, unsigned long);
+void sheep_vector_reserve(struct sheep_vector *, unsigned long);
 void *sheep_vector_pop(struct sheep_vector *);
 
 #endif /* _SHEEP_VECTOR_H */
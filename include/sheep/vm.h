@@ -11,29 +11,50 @@
 #include <sheep/object.h>
 #include <sheep/vector.h>
 #include <sheep/alien.h>
+#include <sheep/name.h>
 #include <sheep/map.h>
+#include <sheep/gc.h>
 #include <stdarg.h>
 
 struct sheep_vm {
 	/* Object management */
-	struct sheep_objects *fulls;
-	struct sheep_objects *parts;
+	struct sheep_objects *nursery[SHEEP_GC_CLASSES];
+	struct sheep_objects *parts[SHEEP_GC_CLASSES];
+	struct sheep_objects *fulls[SHEEP_GC_CLASSES];
+	struct sheep_objects *unswept[SHEEP_GC_CLASSES];
+	int sweep_release;
+	unsigned int nr_nursery;
+	unsigned int nr_pools;
+	unsigned int major_pools;
+	struct sheep_objects *unused;
+	unsigned int nr_unused;
+	struct sheep_gc_config gc_config;
+	struct sheep_gc_stats gc_stats;
+	int gc_trace;
+	struct sheep_vector remembered;
 	struct sheep_vector protected;
+	struct sheep_vector gray;
+	int gray_overflow;
 	int gc_disabled;
 
-	char **keys;
+	struct sheep_symbols symbols;
+	struct sheep_vector keys;	/* interned */
+	struct sheep_map key_slots;
 	struct sheep_vector globals;
 
 	/* Compiler */
 	struct sheep_map specials;
 	struct sheep_map builtins;
 	struct sheep_module main;
+	struct sheep_map modules;	/* name or path -> global slot */
 
 	/* Evaluator */
 	struct sheep_indirect *pending;
 	struct sheep_vector stack;
 	struct sheep_vector calls;	/* [lastpc lastbasep lastfunction] */
 	char *error;
+	const char *error_filename;
+	unsigned long error_lineno;
 };
 
 void sheep_error(struct sheep_vm *, const char *, ...);
@@ -22,9 +22,8 @@
 static sheep_t match(struct sheep_vm *vm, unsigned int nr_args)
 {
 	regmatch_t matches[MAX_MATCHES];
-	sheep_t regex_, string_, result = NULL;
+	sheep_t regex_, string_, pos, result = NULL;
 	const char *regex, *string;
-	struct sheep_list *list;
 	unsigned int i;
 	regex_t reg;
 	int status;
@@ -39,7 +38,7 @@ static sheep_t match(struct sheep_vm *vm, unsigned int nr_args)
 		goto out;
 	}
 
-	result = sheep_make_cons(vm, NULL, NULL);
+	result = pos = sheep_make_cons(vm, NULL, NULL);
 	sheep_protect(vm, result);
 
 	string = sheep_rawstring(string_);
@@ -48,7 +47,6 @@ static sheep_t match(struct sheep_vm *vm, unsigned int nr_args)
 	if (status == REG_NOMATCH)
 		goto out_result;
 
-	list = sheep_list(result);
 	for (i = 0; i < MAX_MATCHES && matches[i].rm_so != -1; i++) {
 		unsigned long start, end, len;
 		char *sub;
@@ -59,10 +57,7 @@ static sheep_t match(struct sheep_vm *vm, unsigned int nr_args)
 		sub = sheep_malloc(len + 1);
 		memcpy(sub, string + start, len);
 		sub[len] = 0;
-		list->head = __sheep_make_string(vm, sub, len);
-
-		list->tail = sheep_make_cons(vm, NULL, NULL);
-		list = sheep_list(list->tail);
+		pos = sheep_list_append(vm, pos, __sheep_make_string(vm, sub, len));
 	}
 out_result:
 	sheep_unprotect(vm, result);
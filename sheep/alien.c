@@ -10,11 +10,6 @@
 
 #include <sheep/alien.h>
 
-static void alien_free(struct sheep_vm *vm, sheep_t sheep)
-{
-	sheep_free(sheep_data(sheep));
-}
-
 static enum sheep_call alien_call(struct sheep_vm *vm,
 				  sheep_t callable,
 				  unsigned int nr_args,
@@ -44,7 +39,6 @@ static void alien_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
 
 const struct sheep_type sheep_alien_type = {
 	.name = "alien",
-	.free = alien_free,
 	.call = alien_call,
 	.format = alien_format,
 };
@@ -54,9 +48,12 @@ sheep_t sheep_make_alien(struct sheep_vm *vm,
 			 const char *name)
 {
 	struct sheep_alien *alien;
+	sheep_t sheep;
 
-	alien = sheep_malloc(sizeof(struct sheep_alien));
+	sheep = __sheep_make_object(vm, &sheep_alien_type,
+				sizeof(struct sheep_alien));
+	alien = sheep_data(sheep);
 	alien->function = function;
 	alien->name = name;
-	return sheep_make_object(vm, &sheep_alien_type, alien);
+	return sheep;
 }
@@ -0,0 +1,279 @@
+/*
+ * sheep/array.c
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#include <sheep/compile.h>
+#include <sheep/number.h>
+#include <sheep/object.h>
+#include <sheep/string.h>
+#include <sheep/unpack.h>
+#include <sheep/util.h>
+#include <sheep/gc.h>
+#include <sheep/vm.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sheep/array.h>
+
+static void array_mark(sheep_t sheep)
+{
+	struct sheep_vector *array;
+	unsigned long i;
+
+	array = sheep_array(sheep);
+	for (i = 0; i < array->nr_items; i++)
+		sheep_mark(array->items[i]);
+}
+
+static void array_free(struct sheep_vm *vm, sheep_t sheep)
+{
+	sheep_free(sheep_array(sheep)->items);
+}
+
+static int array_test(sheep_t sheep)
+{
+	return sheep_array(sheep)->nr_items != 0;
+}
+
+static int array_equal(sheep_t a, sheep_t b)
+{
+	struct sheep_vector *aa, *ab;
+	unsigned long i;
+
+	aa = sheep_array(a);
+	ab = sheep_array(b);
+	if (aa->nr_items != ab->nr_items)
+		return 0;
+	for (i = 0; i < aa->nr_items; i++)
+		if (!sheep_equal(aa->items[i], ab->items[i]))
+			return 0;
+	return 1;
+}
+
+static void array_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
+{
+	struct sheep_vector *array;
+	unsigned long i;
+
+	array = sheep_array(sheep);
+	sheep_strbuf_add(sb, "[");
+	for (i = 0; i < array->nr_items; i++) {
+		if (i)
+			sheep_strbuf_add(sb, " ");
+		__sheep_format(array->items[i], sb, 1);
+	}
+	sheep_strbuf_add(sb, "]");
+}
+
+static size_t array_length(sheep_t sheep)
+{
+	return sheep_array(sheep)->nr_items;
+}
+
+static sheep_t array_concat(struct sheep_vm *vm,
+			    sheep_t sheep,
+			    unsigned int nr_args)
+{
+	struct sheep_vector *array;
+	unsigned long base, nr = 0;
+	unsigned int i;
+	sheep_t result;
+
+	base = vm->stack.nr_items - nr_args;
+	for (i = 0; i < nr_args; i++) {
+		sheep_t array_ = vm->stack.items[base + i];
+
+		if (sheep_unpack(vm, array_, 'V', &array))
+			return NULL;
+		nr += array->nr_items;
+	}
+
+	/* The arguments are still on the stack */
+	result = sheep_make_array(vm, 0, NULL);
+	sheep_vector_reserve(sheep_array(result), nr);
+	for (i = 0; i < nr_args; i++) {
+		struct sheep_vector *new = sheep_array(result);
+
+		array = sheep_array(vm->stack.items[base + i]);
+		memcpy(new->items + new->nr_items, array->items,
+		       sizeof(sheep_t) * array->nr_items);
+		new->nr_items += array->nr_items;
+	}
+	vm->stack.nr_items = base;
+	return result;
+}
+
+static sheep_t array_reverse(struct sheep_vm *vm, sheep_t sheep)
+{
+	struct sheep_vector *array, *new;
+	unsigned long i;
+	sheep_t result;
+
+	sheep_protect(vm, sheep);
+	result = sheep_make_array(vm, 0, NULL);
+	sheep_unprotect(vm, sheep);
+
+	array = sheep_array(sheep);
+	new = sheep_array(result);
+	sheep_vector_reserve(new, array->nr_items);
+	for (i = 0; i < array->nr_items; i++)
+		new->items[i] = array->items[array->nr_items - i - 1];
+	new->nr_items = array->nr_items;
+	return result;
+}
+
+static sheep_t array_nth(struct sheep_vm *vm, size_t n, sheep_t sheep)
+{
+	struct sheep_vector *array;
+
+	array = sheep_array(sheep);
+	if (n >= array->nr_items) {
+		sheep_error(vm, "index %lu out of range [0, %lu)",
+			n, array->nr_items);
+		return NULL;
+	}
+	return array->items[n];
+}
+
+static sheep_t array_slice(struct sheep_vm *vm,
+			   sheep_t sheep,
+			   size_t from,
+			   size_t to)
+{
+	struct sheep_vector *array;
+	sheep_t result;
+
+	array = sheep_array(sheep);
+	if (to > array->nr_items) {
+		sheep_error(vm, "index %lu out of range [0, %lu)",
+			to, array->nr_items);
+		return NULL;
+	}
+
+	sheep_protect(vm, sheep);
+	result = sheep_make_array(vm, to - from,
+				  (sheep_t *)array->items + from);
+	sheep_unprotect(vm, sheep);
+	return result;
+}
+
+static sheep_t array_position(struct sheep_vm *vm, sheep_t item, sheep_t sheep)
+{
+	struct sheep_vector *array;
+	unsigned long i;
+
+	array = sheep_array(sheep);
+	for (i = 0; i < array->nr_items; i++)
+		if (sheep_equal(item, array->items[i]))
+			return sheep_make_number(vm, i);
+	return &sheep_nil;
+}
+
+static const struct sheep_sequence array_sequence = {
+	.length = array_length,
+	.concat = array_concat,
+	.reverse = array_reverse,
+	.nth = array_nth,
+	.slice = array_slice,
+	.position = array_position,
+};
+
+const struct sheep_type sheep_array_type = {
+	.name = "vector",
+	.mark = array_mark,
+	.free = array_free,
+	.compile = sheep_compile_array,
+	.test = array_test,
+	.equal = array_equal,
+	.format = array_format,
+	.sequence = &array_sequence,
+};
+
+/* A vector of a copy of @nr_items @items, which must be rooted */
+sheep_t sheep_make_array(struct sheep_vm *vm,
+			 unsigned long nr_items,
+			 sheep_t *items)
+{
+	struct sheep_vector *array;
+	sheep_t sheep;
+
+	sheep = __sheep_make_object(vm, &sheep_array_type,
+				    sizeof(struct sheep_vector));
+	array = sheep_array(sheep);
+	memset(array, 0, sizeof(struct sheep_vector));
+	if (nr_items) {
+		sheep_vector_reserve(array, nr_items);
+		memcpy(array->items, items, sizeof(sheep_t) * nr_items);
+		array->nr_items = nr_items;
+	}
+	return sheep;
+}
+
+void sheep_array_push(struct sheep_vm *vm, sheep_t array, sheep_t item)
+{
+	sheep_vector_push(sheep_array(array), item);
+	sheep_write_barrier(vm, array, item);
+}
+
+int sheep_array_set(struct sheep_vm *vm, sheep_t array_, long index,
+		    sheep_t item)
+{
+	struct sheep_vector *array = sheep_array(array_);
+
+	if (index < 0 || (unsigned long)index >= array->nr_items) {
+		sheep_error(vm, "index %ld out of range [0, %lu)",
+			index, array->nr_items);
+		return -1;
+	}
+	array->items[index] = item;
+	sheep_write_barrier(vm, array_, item);
+	return 0;
+}
+
+/* (vector &rest items) */
+static sheep_t builtin_vector(struct sheep_vm *vm, unsigned int nr_args)
+{
+	unsigned long base;
+	sheep_t array;
+
+	base = vm->stack.nr_items - nr_args;
+	array = sheep_make_array(vm, nr_args,
+				 (sheep_t *)vm->stack.items + base);
+	vm->stack.nr_items = base;
+	return array;
+}
+
+/* (push vector item) */
+static sheep_t builtin_push(struct sheep_vm *vm, unsigned int nr_args)
+{
+	sheep_t array, item;
+
+	if (sheep_unpack_stack(vm, nr_args, "vo", &array, &item))
+		return NULL;
+
+	sheep_array_push(vm, array, item);
+	return array;
+}
+
+/* (pop vector) */
+static sheep_t builtin_pop(struct sheep_vm *vm, unsigned int nr_args)
+{
+	sheep_t array;
+
+	if (sheep_unpack_stack(vm, nr_args, "v", &array))
+		return NULL;
+
+	if (!sheep_array(array)->nr_items) {
+		sheep_error(vm, "can not pop from empty vector");
+		return NULL;
+	}
+	return sheep_vector_pop(sheep_array(array));
+}
+
+void sheep_array_builtins(struct sheep_vm *vm)
+{
+	sheep_vm_function(vm, "vector", builtin_vector);
+	sheep_vm_function(vm, "push", builtin_push);
+	sheep_vm_function(vm, "pop", builtin_pop);
+}
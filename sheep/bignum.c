@@ -0,0 +1,663 @@
+/*
+ * sheep/bignum.c
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#include <sheep/compile.h>
+#include <sheep/number.h>
+#include <sheep/object.h>
+#include <sheep/util.h>
+#include <sheep/gc.h>
+#include <sheep/vm.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+
+#include <sheep/bignum.h>
+
+#define DIGIT_BITS		32
+#define FIXNUM_DIGITS		(sizeof(long) / sizeof(uint32_t))
+
+/* Operands of at least this many digits are multiplied by Karatsuba */
+#define KARATSUBA_THRESHOLD	32
+
+/*
+ * Magnitudes: arrays of digits, least significant first.  The
+ * helpers below do not care about leading zeroes, except where
+ * noted.
+ */
+
+static unsigned int mag_norm(const uint32_t *a, unsigned int na)
+{
+	while (na && !a[na - 1])
+		na--;
+	return na;
+}
+
+/* Compare normalized magnitudes */
+static int mag_cmp(const uint32_t *a, unsigned int na,
+		   const uint32_t *b, unsigned int nb)
+{
+	if (na != nb)
+		return na < nb ? -1 : 1;
+	while (na--)
+		if (a[na] != b[na])
+			return a[na] < b[na] ? -1 : 1;
+	return 0;
+}
+
+/* @r[0..@na] = @a + @b, @na >= @nb */
+static void mag_add(uint32_t *r, const uint32_t *a, unsigned int na,
+		    const uint32_t *b, unsigned int nb)
+{
+	uint64_t carry = 0;
+	unsigned int i;
+
+	for (i = 0; i < na; i++) {
+		carry += a[i];
+		if (i < nb)
+			carry += b[i];
+		r[i] = (uint32_t)carry;
+		carry >>= DIGIT_BITS;
+	}
+	r[na] = (uint32_t)carry;
+}
+
+/* @r[0..@na) = @a - @b, @a >= @b */
+static void mag_sub(uint32_t *r, const uint32_t *a, unsigned int na,
+		    const uint32_t *b, unsigned int nb)
+{
+	int64_t borrow = 0;
+	unsigned int i;
+
+	for (i = 0; i < na; i++) {
+		borrow += a[i];
+		if (i < nb)
+			borrow -= b[i];
+		r[i] = (uint32_t)borrow;
+		borrow = borrow < 0 ? -1 : 0;
+	}
+}
+
+/* @r[0..@nr) += @a, the sum must fit */
+static void mag_add_into(uint32_t *r, unsigned int nr,
+			 const uint32_t *a, unsigned int na)
+{
+	uint64_t carry = 0;
+	unsigned int i;
+
+	for (i = 0; i < nr && (i < na || carry); i++) {
+		carry += r[i];
+		if (i < na)
+			carry += a[i];
+		r[i] = (uint32_t)carry;
+		carry >>= DIGIT_BITS;
+	}
+}
+
+/* @r[0..@nr) -= @a, the difference must not be negative */
+static void mag_sub_into(uint32_t *r, unsigned int nr,
+			 const uint32_t *a, unsigned int na)
+{
+	int64_t borrow = 0;
+	unsigned int i;
+
+	for (i = 0; i < nr && (i < na || borrow); i++) {
+		borrow += r[i];
+		if (i < na)
+			borrow -= a[i];
+		r[i] = (uint32_t)borrow;
+		borrow = borrow < 0 ? -1 : 0;
+	}
+}
+
+/* @r[0..@na+@nb) = @a * @b, @r zeroed */
+static void mag_mul_school(uint32_t *r, const uint32_t *a, unsigned int na,
+			   const uint32_t *b, unsigned int nb)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < na; i++) {
+		uint64_t carry = 0;
+
+		if (!a[i])
+			continue;
+		for (j = 0; j < nb; j++) {
+			carry += (uint64_t)a[i] * b[j] + r[i + j];
+			r[i + j] = (uint32_t)carry;
+			carry >>= DIGIT_BITS;
+		}
+		r[i + nb] = (uint32_t)carry;
+	}
+}
+
+/*
+ * @r[0..@na+@nb) = @a * @b, @r zeroed
+ *
+ * With a = a1 * B^h + a0 and b = b1 * B^h + b0, the product is
+ * z2 * B^2h + z1 * B^h + z0, where z0 = a0 * b0, z2 = a1 * b1 and
+ * z1 = (a0 + a1) * (b0 + b1) - z0 - z2: three multiplications of
+ * half the size instead of four.
+ */
+static void mag_mul(uint32_t *r, const uint32_t *a, unsigned int na,
+		    const uint32_t *b, unsigned int nb)
+{
+	unsigned int h, nsa, nsb;
+	uint32_t *sa, *sb, *z1;
+
+	if (na < KARATSUBA_THRESHOLD || nb < KARATSUBA_THRESHOLD) {
+		mag_mul_school(r, a, na, b, nb);
+		return;
+	}
+
+	h = (na < nb ? na : nb) / 2;
+
+	/* z0 and z2 go to their final, disjoint, places */
+	mag_mul(r, a, h, b, h);
+	mag_mul(r + 2 * h, a + h, na - h, b + h, nb - h);
+
+	nsa = (na - h > h ? na - h : h) + 1;
+	nsb = (nb - h > h ? nb - h : h) + 1;
+	sa = sheep_malloc(sizeof(uint32_t) * nsa);
+	sb = sheep_malloc(sizeof(uint32_t) * nsb);
+	if (na - h >= h)
+		mag_add(sa, a + h, na - h, a, h);
+	else
+		mag_add(sa, a, h, a + h, na - h);
+	if (nb - h >= h)
+		mag_add(sb, b + h, nb - h, b, h);
+	else
+		mag_add(sb, b, h, b + h, nb - h);
+
+	z1 = sheep_zalloc(sizeof(uint32_t) * (nsa + nsb));
+	mag_mul(z1, sa, nsa, sb, nsb);
+	mag_sub_into(z1, nsa + nsb, r, 2 * h);
+	mag_sub_into(z1, nsa + nsb, r + 2 * h, na + nb - 2 * h);
+	mag_add_into(r + h, na + nb - h, z1,
+		     mag_norm(z1, nsa + nsb));
+
+	sheep_free(z1);
+	sheep_free(sb);
+	sheep_free(sa);
+}
+
+/* @a[0..@na) /= @d, returns the remainder */
+static uint32_t mag_divsmall(uint32_t *a, unsigned int na, uint32_t d)
+{
+	uint64_t rem = 0;
+
+	while (na--) {
+		rem = (rem << DIGIT_BITS) | a[na];
+		a[na] = (uint32_t)(rem / d);
+		rem %= d;
+	}
+	return (uint32_t)rem;
+}
+
+static unsigned int leading_zeroes(uint32_t x)
+{
+	unsigned int n = 0;
+
+	while (!(x & 0x80000000u)) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * @q[0..@nu-@nv] = @u / @v, @r[0..@nv) = @u % @v
+ *
+ * Knuth's algorithm D, with normalized @u and @v, @nu >= @nv >= 2.
+ */
+static void mag_divmod(uint32_t *q, uint32_t *r,
+		       const uint32_t *u, unsigned int nu,
+		       const uint32_t *v, unsigned int nv)
+{
+	unsigned int shift, i;
+	uint32_t *un, *vn;
+	int j;
+
+	/* Shift the divisor until its top bit is set */
+	shift = leading_zeroes(v[nv - 1]);
+	vn = sheep_malloc(sizeof(uint32_t) * nv);
+	un = sheep_malloc(sizeof(uint32_t) * (nu + 1));
+	for (i = nv - 1; i > 0; i--)
+		vn[i] = (v[i] << shift) |
+			(shift ? v[i - 1] >> (DIGIT_BITS - shift) : 0);
+	vn[0] = v[0] << shift;
+	un[nu] = shift ? u[nu - 1] >> (DIGIT_BITS - shift) : 0;
+	for (i = nu - 1; i > 0; i--)
+		un[i] = (u[i] << shift) |
+			(shift ? u[i - 1] >> (DIGIT_BITS - shift) : 0);
+	un[0] = u[0] << shift;
+
+	for (j = nu - nv; j >= 0; j--) {
+		uint64_t num, qhat, rhat;
+		int64_t borrow, t;
+
+		/* Estimate the quotient digit from the top digits */
+		num = ((uint64_t)un[j + nv] << DIGIT_BITS) | un[j + nv - 1];
+		qhat = num / vn[nv - 1];
+		rhat = num % vn[nv - 1];
+		while (qhat >> DIGIT_BITS ||
+		       qhat * vn[nv - 2] >
+		       ((rhat << DIGIT_BITS) | un[j + nv - 2])) {
+			qhat--;
+			rhat += vn[nv - 1];
+			if (rhat >> DIGIT_BITS)
+				break;
+		}
+
+		/* Multiply and subtract */
+		borrow = 0;
+		for (i = 0; i < nv; i++) {
+			uint64_t p = qhat * vn[i];
+
+			t = un[i + j] - borrow - (int64_t)(p & 0xffffffffu);
+			un[i + j] = (uint32_t)t;
+			borrow = (int64_t)(p >> DIGIT_BITS) - (t >> DIGIT_BITS);
+		}
+		t = un[j + nv] - borrow;
+		un[j + nv] = (uint32_t)t;
+
+		/* The estimate was one too large, add back */
+		if (t < 0) {
+			uint64_t carry = 0;
+
+			qhat--;
+			for (i = 0; i < nv; i++) {
+				carry += (uint64_t)un[i + j] + vn[i];
+				un[i + j] = (uint32_t)carry;
+				carry >>= DIGIT_BITS;
+			}
+			un[j + nv] += (uint32_t)carry;
+		}
+		q[j] = (uint32_t)qhat;
+	}
+
+	/* Unnormalize the remainder */
+	for (i = 0; i < nv; i++)
+		r[i] = (un[i] >> shift) |
+			(shift ? un[i + 1] << (DIGIT_BITS - shift) : 0);
+
+	sheep_free(un);
+	sheep_free(vn);
+}
+
+static void bignum_free(struct sheep_vm *vm, sheep_t sheep)
+{
+	struct sheep_bignum *bignum = sheep_bignum(sheep);
+
+	if (bignum->digits != (uint32_t *)(bignum + 1))
+		sheep_free(bignum->digits);
+}
+
+static int bignum_test(sheep_t sheep)
+{
+	return 1;
+}
+
+static int bignum_equal(sheep_t a, sheep_t b)
+{
+	return !sheep_bignum_cmp(a, b);
+}
+
+static unsigned long bignum_hash(sheep_t sheep)
+{
+	struct sheep_bignum *bignum = sheep_bignum(sheep);
+
+	return sheep_hash(bignum->digits,
+			  sizeof(uint32_t) * bignum->nr_digits) ^
+		bignum->negative;
+}
+
+static void bignum_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
+{
+	struct sheep_bignum *bignum = sheep_bignum(sheep);
+	unsigned int n = bignum->nr_digits, nr_chunks = 0;
+	uint32_t *work, *chunks;
+
+	/* Peel off decimal chunks of nine digits each */
+	work = sheep_malloc(sizeof(uint32_t) * n);
+	memcpy(work, bignum->digits, sizeof(uint32_t) * n);
+	chunks = sheep_malloc(sizeof(uint32_t) * (n * 10 / 9 + 1));
+	while (n) {
+		chunks[nr_chunks++] = mag_divsmall(work, n, 1000000000);
+		n = mag_norm(work, n);
+	}
+
+	if (bignum->negative)
+		sheep_strbuf_add(sb, "-");
+	sheep_strbuf_addf(sb, "%u", chunks[--nr_chunks]);
+	while (nr_chunks--)
+		sheep_strbuf_addf(sb, "%09u", chunks[nr_chunks]);
+
+	sheep_free(chunks);
+	sheep_free(work);
+}
+
+const struct sheep_type sheep_bignum_type = {
+	.name = "bignum",
+	.free = bignum_free,
+	.compile = sheep_compile_constant,
+	.test = bignum_test,
+	.equal = bignum_equal,
+	.hash = bignum_hash,
+	.format = bignum_format,
+};
+
+/*
+ * Make an integer of the allocated magnitude @digits, which is
+ * taken over.  Magnitudes in the fixnum range become fixnums.
+ */
+static sheep_t make_integer(struct sheep_vm *vm, int negative,
+			    uint32_t *digits, unsigned int nr_digits)
+{
+	struct sheep_bignum *bignum;
+	size_t size;
+	sheep_t sheep;
+
+	nr_digits = mag_norm(digits, nr_digits);
+	if (!nr_digits)
+		negative = 0;
+	if (nr_digits <= FIXNUM_DIGITS) {
+		unsigned long value = 0;
+		unsigned int i = nr_digits;
+
+		while (i--)
+			value = (value << (DIGIT_BITS - 1) << 1) | digits[i];
+		if (!negative && value <= SHEEP_FIXNUM_MAX) {
+			sheep_free(digits);
+			return sheep_make_number(vm, value);
+		}
+		/* The fixnum range has one more negative number */
+		if (negative && value - 1 <= SHEEP_FIXNUM_MAX) {
+			sheep_free(digits);
+			return sheep_make_number(vm, -(long)(value - 1) - 1);
+		}
+	}
+
+	size = sizeof(uint32_t) * nr_digits;
+	if (sizeof(struct sheep_bignum) + size <= SHEEP_INLINE_MAX) {
+		sheep = __sheep_make_object(vm, &sheep_bignum_type,
+					sizeof(struct sheep_bignum) + size);
+		bignum = sheep_bignum(sheep);
+		bignum->digits = (uint32_t *)(bignum + 1);
+		memcpy(bignum->digits, digits, size);
+		sheep_free(digits);
+	} else {
+		sheep = __sheep_make_object(vm, &sheep_bignum_type,
+					sizeof(struct sheep_bignum));
+		bignum = sheep_bignum(sheep);
+		bignum->digits = digits;
+	}
+	bignum->negative = negative;
+	bignum->nr_digits = nr_digits;
+	return sheep;
+}
+
+/* An integer operand, fixnums are expanded into @buf */
+struct operand {
+	int negative;
+	unsigned int nr_digits;
+	const uint32_t *digits;
+	uint32_t buf[FIXNUM_DIGITS];
+};
+
+/* The magnitude of @number, in FIXNUM_DIGITS @digits */
+static void long_digits(long number, uint32_t *digits)
+{
+	unsigned long value;
+	unsigned int i;
+
+	value = number < 0 ? -(unsigned long)number : (unsigned long)number;
+	for (i = 0; i < FIXNUM_DIGITS; i++) {
+		digits[i] = (uint32_t)value;
+		value = value >> (DIGIT_BITS - 1) >> 1;
+	}
+}
+
+static void operand(sheep_t sheep, struct operand *op)
+{
+	if (sheep_is_fixnum(sheep)) {
+		long number = sheep_fixnum(sheep);
+
+		op->negative = number < 0;
+		long_digits(number, op->buf);
+		op->digits = op->buf;
+		op->nr_digits = mag_norm(op->buf, FIXNUM_DIGITS);
+	} else {
+		struct sheep_bignum *bignum = sheep_bignum(sheep);
+
+		op->negative = bignum->negative;
+		op->digits = bignum->digits;
+		op->nr_digits = bignum->nr_digits;
+	}
+}
+
+sheep_t sheep_bignum_from_long(struct sheep_vm *vm, long number)
+{
+	uint32_t *digits;
+
+	digits = sheep_malloc(sizeof(uint32_t) * FIXNUM_DIGITS);
+	long_digits(number, digits);
+	return make_integer(vm, number < 0, digits, FIXNUM_DIGITS);
+}
+
+static sheep_t add(struct sheep_vm *vm, sheep_t a, sheep_t b, int negate_b)
+{
+	struct operand x, y, *big, *small;
+	uint32_t *digits;
+	int negative;
+
+	operand(a, &x);
+	operand(b, &y);
+	if (negate_b)
+		y.negative = !y.negative;
+
+	if (mag_cmp(x.digits, x.nr_digits, y.digits, y.nr_digits) >= 0) {
+		big = &x;
+		small = &y;
+	} else {
+		big = &y;
+		small = &x;
+	}
+
+	digits = sheep_malloc(sizeof(uint32_t) * (big->nr_digits + 1));
+	negative = big->negative;
+	if (x.negative == y.negative)
+		mag_add(digits, big->digits, big->nr_digits,
+			small->digits, small->nr_digits);
+	else {
+		mag_sub(digits, big->digits, big->nr_digits,
+			small->digits, small->nr_digits);
+		digits[big->nr_digits] = 0;
+	}
+	return make_integer(vm, negative, digits, big->nr_digits + 1);
+}
+
+sheep_t sheep_bignum_add(struct sheep_vm *vm, sheep_t a, sheep_t b)
+{
+	return add(vm, a, b, 0);
+}
+
+sheep_t sheep_bignum_sub(struct sheep_vm *vm, sheep_t a, sheep_t b)
+{
+	return add(vm, a, b, 1);
+}
+
+sheep_t sheep_bignum_mul(struct sheep_vm *vm, sheep_t a, sheep_t b)
+{
+	unsigned int nr_digits;
+	struct operand x, y;
+	uint32_t *digits;
+
+	operand(a, &x);
+	operand(b, &y);
+	nr_digits = x.nr_digits + y.nr_digits;
+	digits = sheep_zalloc(sizeof(uint32_t) * (nr_digits ? nr_digits : 1));
+	mag_mul(digits, x.digits, x.nr_digits, y.digits, y.nr_digits);
+	return make_integer(vm, x.negative != y.negative, digits, nr_digits);
+}
+
+/*
+ * Truncating division like C's: the quotient is rounded towards
+ * zero and the remainder has the sign of the dividend.
+ */
+int sheep_bignum_divmod(struct sheep_vm *vm, sheep_t a, sheep_t b,
+			sheep_t *quotientp, sheep_t *remainderp)
+{
+	sheep_t quotient, remainder;
+	unsigned int nq, nr;
+	struct operand x, y;
+	uint32_t *q, *r;
+
+	operand(a, &x);
+	operand(b, &y);
+	if (!y.nr_digits) {
+		sheep_error(vm, "division by zero");
+		return -1;
+	}
+
+	if (mag_cmp(x.digits, x.nr_digits, y.digits, y.nr_digits) < 0) {
+		nq = 1;
+		q = sheep_zalloc(sizeof(uint32_t));
+		nr = x.nr_digits ? x.nr_digits : 1;
+		r = sheep_zalloc(sizeof(uint32_t) * nr);
+		memcpy(r, x.digits, sizeof(uint32_t) * x.nr_digits);
+	} else if (y.nr_digits == 1) {
+		nq = x.nr_digits;
+		q = sheep_malloc(sizeof(uint32_t) * nq);
+		memcpy(q, x.digits, sizeof(uint32_t) * nq);
+		nr = 1;
+		r = sheep_malloc(sizeof(uint32_t));
+		r[0] = mag_divsmall(q, nq, y.digits[0]);
+	} else {
+		nq = x.nr_digits - y.nr_digits + 1;
+		q = sheep_malloc(sizeof(uint32_t) * nq);
+		nr = y.nr_digits;
+		r = sheep_malloc(sizeof(uint32_t) * nr);
+		mag_divmod(q, r, x.digits, x.nr_digits,
+			   y.digits, y.nr_digits);
+	}
+
+	quotient = make_integer(vm, x.negative != y.negative, q, nq);
+	sheep_protect(vm, quotient);
+	remainder = make_integer(vm, x.negative, r, nr);
+	sheep_unprotect(vm, quotient);
+
+	if (quotientp)
+		*quotientp = quotient;
+	if (remainderp)
+		*remainderp = remainder;
+	return 0;
+}
+
+/* @a times 2 to the power of @count */
+sheep_t sheep_bignum_shl(struct sheep_vm *vm, sheep_t a, unsigned int count)
+{
+	unsigned int nr_digits, shift, words, i;
+	struct operand x;
+	uint32_t *digits;
+
+	operand(a, &x);
+	words = count / DIGIT_BITS;
+	shift = count % DIGIT_BITS;
+	nr_digits = x.nr_digits + words + 1;
+	digits = sheep_zalloc(sizeof(uint32_t) * nr_digits);
+	for (i = 0; i < x.nr_digits; i++) {
+		uint64_t value = (uint64_t)x.digits[i] << shift;
+
+		digits[words + i] |= (uint32_t)value;
+		digits[words + i + 1] = (uint32_t)(value >> DIGIT_BITS);
+	}
+	return make_integer(vm, x.negative, digits, nr_digits);
+}
+
+sheep_t sheep_bignum_neg(struct sheep_vm *vm, sheep_t sheep)
+{
+	struct operand x;
+	uint32_t *digits;
+
+	operand(sheep, &x);
+	digits = sheep_malloc(sizeof(uint32_t) * (x.nr_digits + 1));
+	memcpy(digits, x.digits, sizeof(uint32_t) * x.nr_digits);
+	return make_integer(vm, !x.negative, digits, x.nr_digits);
+}
+
+int sheep_bignum_cmp(sheep_t a, sheep_t b)
+{
+	struct operand x, y;
+	int cmp;
+
+	operand(a, &x);
+	operand(b, &y);
+	if (x.negative != y.negative)
+		return x.negative ? -1 : 1;
+	cmp = mag_cmp(x.digits, x.nr_digits, y.digits, y.nr_digits);
+	return x.negative ? -cmp : cmp;
+}
+
+double sheep_bignum_double(sheep_t sheep)
+{
+	struct operand x;
+	double value = 0;
+	unsigned int i;
+
+	operand(sheep, &x);
+	for (i = x.nr_digits; i; i--)
+		value = value * 4294967296.0 + x.digits[i - 1];
+	return x.negative ? -value : value;
+}
+
+static int digit_value(int c)
+{
+	if (isdigit(c))
+		return c - '0';
+	if (isalpha(c))
+		return tolower(c) - 'a' + 10;
+	return 36;
+}
+
+/* Parse an integer literal like strtol() with base 0 does */
+int sheep_parse_bignum(struct sheep_vm *vm, const char *buf, sheep_t *sheepp)
+{
+	unsigned int base = 10, nr_digits = 0;
+	uint32_t *digits;
+	int negative = 0;
+	size_t len;
+
+	if (*buf == '-' || *buf == '+')
+		negative = *buf++ == '-';
+	if (buf[0] == '0' && (buf[1] == 'x' || buf[1] == 'X') &&
+	    isxdigit((unsigned char)buf[2])) {
+		base = 16;
+		buf += 2;
+	} else if (buf[0] == '0')
+		base = 8;
+	if (!*buf)
+		return -1;
+
+	/* Every digit adds at most four bits */
+	len = strlen(buf);
+	digits = sheep_zalloc(sizeof(uint32_t) * (len * 4 / DIGIT_BITS + 1));
+	for (; *buf; buf++) {
+		unsigned int value = digit_value((unsigned char)*buf), i;
+		uint64_t carry = value;
+
+		if (value >= base) {
+			sheep_free(digits);
+			return -1;
+		}
+		for (i = 0; i < nr_digits; i++) {
+			carry += (uint64_t)digits[i] * base;
+			digits[i] = (uint32_t)carry;
+			carry >>= DIGIT_BITS;
+		}
+		if (carry)
+			digits[nr_digits++] = (uint32_t)carry;
+	}
+	*sheepp = make_integer(vm, negative, digits, nr_digits);
+	return 0;
+}
@@ -0,0 +1,895 @@
+/*
+ * sheep/bytecode.c
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#include <sheep/function.h>
+#include <sheep/foreign.h>
+#include <sheep/bignum.h>
+#include <sheep/config.h>
+#include <sheep/flonum.h>
+#include <sheep/number.h>
+#include <sheep/object.h>
+#include <sheep/string.h>
+#include <sheep/array.h>
+#include <sheep/bool.h>
+#include <sheep/code.h>
+#include <sheep/list.h>
+#include <sheep/name.h>
+#include <sheep/type.h>
+#include <sheep/util.h>
+#include <sheep/gc.h>
+#include <sheep/vm.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <sheep/bytecode.h>
+
+/*
+ * A .sheepc file starts with a header that ties it to the build
+ * that wrote it and to the hash and size of the source file, as
+ * modification times are too coarse to catch quick edits.  The
+ * number of toplevel forms and a checksum over them follow.  The
+ * forms come in order, each with the names of the module globals
+ * it binds and its function.
+ *
+ * Slot numbers are private to a vm, so instructions that refer to
+ * global slots describe them instead: builtins by name, module
+ * globals by their index in the module's globals, and constants as
+ * serialized objects.  Key slots are stored as the keys.  The code
+ * is stored as it is after sheep_code_finalize(), with relative
+ * branches, and finalized again on load.
+ *
+ * The checksum catches files that were damaged, everything else is
+ * validated while loading so that no cache can crash the vm.
+ */
+
+#define MAGIC	"sheepc\n"
+#define FORMAT	2
+
+enum {
+	SLOT_BUILTIN,
+	SLOT_MODULE,
+	SLOT_CONSTANT,
+};
+
+enum {
+	OBJ_NIL,
+	OBJ_TRUE,
+	OBJ_FALSE,
+	OBJ_FIXNUM,
+	OBJ_FLONUM,
+	OBJ_BIGNUM,
+	OBJ_STRING,
+	OBJ_NAME,
+	OBJ_LIST,
+	OBJ_VECTOR,
+	OBJ_FUNCTION,
+	OBJ_TYPECLASS,
+};
+
+static void put(struct sheep_bytecode *bc, const void *mem, size_t len)
+{
+	if (bc->nr_bytes + len > bc->size) {
+		do
+			bc->size = bc->size ? bc->size * 2 : 4096;
+		while (bc->nr_bytes + len > bc->size);
+		bc->bytes = sheep_realloc(bc->bytes, bc->size);
+	}
+	memcpy(bc->bytes + bc->nr_bytes, mem, len);
+	bc->nr_bytes += len;
+}
+
+static void put_u8(struct sheep_bytecode *bc, unsigned int value)
+{
+	unsigned char byte = value;
+
+	put(bc, &byte, 1);
+}
+
+static void put_u32(struct sheep_bytecode *bc, uint32_t value)
+{
+	put(bc, &value, sizeof(value));
+}
+
+static void put_long(struct sheep_bytecode *bc, long value)
+{
+	put(bc, &value, sizeof(value));
+}
+
+static void put_string(struct sheep_bytecode *bc, const char *str, size_t len)
+{
+	put_u32(bc, len);
+	put(bc, str, len);
+}
+
+static void put_header(struct sheep_bytecode *bc,
+		       unsigned long hash,
+		       size_t size)
+{
+	put(bc, MAGIC, sizeof(MAGIC));
+	put_u32(bc, FORMAT);
+	put_string(bc, SHEEP_VERSION, strlen(SHEEP_VERSION));
+	put_u32(bc, sizeof(long));
+	put_long(bc, hash);
+	put_long(bc, size);
+}
+
+static void put_function(struct sheep_bytecode *, struct sheep_vm *,
+			 struct sheep_module *, struct sheep_function *);
+
+static void put_object(struct sheep_bytecode *bc,
+		       struct sheep_vm *vm,
+		       struct sheep_module *mod,
+		       sheep_t sheep)
+{
+	const struct sheep_type *type = sheep_type(sheep);
+
+	if (sheep == &sheep_nil)
+		put_u8(bc, OBJ_NIL);
+	else if (sheep == &sheep_true)
+		put_u8(bc, OBJ_TRUE);
+	else if (sheep == &sheep_false)
+		put_u8(bc, OBJ_FALSE);
+	else if (sheep_is_fixnum(sheep)) {
+		put_u8(bc, OBJ_FIXNUM);
+		put_long(bc, sheep_fixnum(sheep));
+	} else if (type == &sheep_flonum_type) {
+		double value = sheep_flonum(sheep);
+
+		put_u8(bc, OBJ_FLONUM);
+		put(bc, &value, sizeof(value));
+	} else if (type == &sheep_bignum_type || type == &sheep_name_type) {
+		char *repr = sheep_repr(sheep);
+
+		put_u8(bc, type == &sheep_name_type ? OBJ_NAME : OBJ_BIGNUM);
+		put_string(bc, repr, strlen(repr));
+		sheep_free(repr);
+	} else if (type == &sheep_string_type) {
+		struct sheep_string *string = sheep_string(sheep);
+
+		put_u8(bc, OBJ_STRING);
+		put_string(bc, string->bytes, string->nr_bytes);
+	} else if (type == &sheep_list_type) {
+		struct sheep_list *list;
+		unsigned int nr = 0;
+
+		for (list = sheep_list(sheep); list->head;
+		     list = sheep_list(list->tail))
+			nr++;
+		put_u8(bc, OBJ_LIST);
+		put_u32(bc, nr);
+		for (list = sheep_list(sheep); list->head;
+		     list = sheep_list(list->tail))
+			put_object(bc, vm, mod, list->head);
+	} else if (type == &sheep_array_type) {
+		struct sheep_vector *array = sheep_array(sheep);
+		unsigned long i;
+
+		put_u8(bc, OBJ_VECTOR);
+		put_u32(bc, array->nr_items);
+		for (i = 0; i < array->nr_items; i++)
+			put_object(bc, vm, mod, array->items[i]);
+	} else if (type == &sheep_function_type) {
+		put_u8(bc, OBJ_FUNCTION);
+		put_function(bc, vm, mod, sheep_function(sheep));
+	} else if (type == &sheep_typeclass_type) {
+		struct sheep_typeclass *class = sheep_data(sheep);
+		unsigned int i;
+
+		put_u8(bc, OBJ_TYPECLASS);
+		put_string(bc, class->name, strlen(class->name));
+		put_u32(bc, class->nr_slots);
+		for (i = 0; i < class->nr_slots; i++) {
+			const char *name = class->names[i];
+
+			put_string(bc, name, strlen(name));
+		}
+	} else
+		bc->failed = 1;
+}
+
+/* The index of global @slot in @mod, or -1 if it is not owned by it */
+static long module_index(struct sheep_module *mod, unsigned int slot)
+{
+	unsigned long low = 0, high = mod->globals.nr_items / 2;
+
+	while (low < high) {
+		unsigned long this, mid = (low + high) / 2;
+
+		this = (unsigned long)mod->globals.items[mid * 2];
+		if (this == slot)
+			return mid;
+		if (this < slot)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return -1;
+}
+
+static void put_slot(struct sheep_bytecode *bc,
+		     struct sheep_vm *vm,
+		     struct sheep_module *mod,
+		     unsigned int slot)
+{
+	long index = module_index(mod, slot);
+
+	if (index >= 0) {
+		put_u8(bc, SLOT_MODULE);
+		put_u32(bc, index);
+	} else if (slot < bc->nr_builtins && bc->builtins[slot]) {
+		put_u8(bc, SLOT_BUILTIN);
+		put_string(bc, bc->builtins[slot], strlen(bc->builtins[slot]));
+	} else {
+		put_u8(bc, SLOT_CONSTANT);
+		put_object(bc, vm, mod, vm->globals.items[slot]);
+	}
+}
+
+static void put_function(struct sheep_bytecode *bc,
+			 struct sheep_vm *vm,
+			 struct sheep_module *mod,
+			 struct sheep_function *function)
+{
+	struct sheep_code *code = &function->code;
+	unsigned long i, nr_code;
+
+	put_u8(bc, !!function->name);
+	if (function->name)
+		put_string(bc, function->name, strlen(function->name));
+	put_u32(bc, function->nr_locals);
+	put_u32(bc, function->nr_parms);
+
+	if (function->foreign) {
+		put_u32(bc, function->foreign->nr_items);
+		for (i = 0; i < function->foreign->nr_items; i++) {
+			struct sheep_freevar *freevar;
+
+			freevar = function->foreign->items[i];
+			put_u32(bc, freevar->dist);
+			put_u32(bc, freevar->slot);
+		}
+	} else
+		put_u32(bc, 0);
+
+	put_u32(bc, code->lines.nr_items);
+	for (i = 0; i < code->lines.nr_items; i++)
+		put_long(bc, (unsigned long)code->lines.items[i]);
+
+	/* Without the RET appended by sheep_code_finalize() */
+	nr_code = code->code.nr_items - 1;
+	put_u32(bc, nr_code);
+	for (i = 0; i < nr_code; i++) {
+		enum sheep_opcode op;
+		const char *key;
+		unsigned int arg;
+
+		sheep_decode((unsigned long)code->code.items[i], &op, &arg);
+		put_u8(bc, op);
+		switch (op) {
+		case SHEEP_GLOBAL:
+		case SHEEP_SET_GLOBAL:
+		case SHEEP_CLOSURE:
+		case SHEEP_ADD:
+		case SHEEP_SUB:
+		case SHEEP_MUL:
+		case SHEEP_LT:
+		case SHEEP_LE:
+		case SHEEP_EQ:
+			put_slot(bc, vm, mod, arg);
+			break;
+		case SHEEP_HASH:
+		case SHEEP_SET_HASH:
+		case SHEEP_LOAD:
+			key = vm->keys.items[arg];
+			put_string(bc, key, strlen(key));
+			break;
+		default:
+			put_u32(bc, arg);
+		}
+	}
+}
+
+static void add_builtin(const char *name, void *slot, void *data)
+{
+	struct sheep_bytecode *bc = data;
+
+	bc->builtins[(unsigned long)slot] = name;
+}
+
+void sheep_bytecode_init(struct sheep_bytecode *bc, struct sheep_vm *vm)
+{
+	memset(bc, 0, sizeof(struct sheep_bytecode));
+	bc->nr_builtins = vm->globals.nr_items;
+	bc->builtins = sheep_zalloc(sizeof(char *) * bc->nr_builtins);
+	sheep_map_each(&vm->builtins, add_builtin, bc);
+}
+
+/*
+ * Add the toplevel @function of @mod, whose compilation bound the
+ * module globals from index @nr_globals on.
+ */
+void sheep_bytecode_add(struct sheep_bytecode *bc,
+			struct sheep_vm *vm,
+			struct sheep_module *mod,
+			unsigned long nr_globals,
+			sheep_t function)
+{
+	unsigned long i;
+
+	put_u32(bc, (mod->globals.nr_items - nr_globals * 2) / 2);
+	for (i = nr_globals * 2; i < mod->globals.nr_items; i += 2) {
+		const char *name = mod->globals.items[i + 1];
+
+		put_string(bc, name, strlen(name));
+	}
+	put_function(bc, vm, mod, sheep_function(function));
+	bc->nr_forms++;
+}
+
+/* Write the forms to @path, tied to the source's @hash and @size */
+int sheep_bytecode_write(struct sheep_bytecode *bc,
+			 const char *path,
+			 unsigned long hash,
+			 size_t size)
+{
+	struct sheep_bytecode header;
+	int fd, ret = -1;
+	char *tmp;
+	FILE *fp;
+
+	if (bc->failed)
+		return -1;
+
+	memset(&header, 0, sizeof(header));
+	put_header(&header, hash, size);
+	put_u32(&header, bc->nr_forms);
+	put_long(&header, sheep_hash(bc->bytes, bc->nr_bytes));
+
+	/* Readers never see a partial file */
+	tmp = sheep_malloc(strlen(path) + 32);
+	sprintf(tmp, "%s.%ld", path, (long)getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		goto out;
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		goto out_unlink;
+	}
+	fwrite(header.bytes, 1, header.nr_bytes, fp);
+	fwrite(bc->bytes, 1, bc->nr_bytes, fp);
+	if (ferror(fp) | fclose(fp))
+		goto out_unlink;
+	if (!rename(tmp, path))
+		ret = 0;
+out_unlink:
+	if (ret)
+		unlink(tmp);
+out:
+	sheep_free(header.bytes);
+	sheep_free(tmp);
+	return ret;
+}
+
+void sheep_bytecode_exit(struct sheep_bytecode *bc)
+{
+	sheep_free(bc->bytes);
+	sheep_free(bc->builtins);
+}
+
+struct input {
+	struct sheep_vm *vm;
+	const char *filename;
+	const char *pos;
+	const char *end;
+	struct sheep_vector slots;	/* module global index -> slot */
+	size_t max_locals;
+	int failed;
+};
+
+static void get(struct input *in, void *mem, size_t len)
+{
+	if ((size_t)(in->end - in->pos) < len) {
+		memset(mem, 0, len);
+		in->failed = 1;
+		return;
+	}
+	memcpy(mem, in->pos, len);
+	in->pos += len;
+}
+
+static unsigned int get_u8(struct input *in)
+{
+	unsigned char byte;
+
+	get(in, &byte, 1);
+	return byte;
+}
+
+static uint32_t get_u32(struct input *in)
+{
+	uint32_t value;
+
+	get(in, &value, sizeof(value));
+	return value;
+}
+
+static long get_long(struct input *in)
+{
+	long value;
+
+	get(in, &value, sizeof(value));
+	return value;
+}
+
+/* A count of items that take at least one byte each */
+static uint32_t get_count(struct input *in)
+{
+	uint32_t nr = get_u32(in);
+
+	if (nr > (size_t)(in->end - in->pos)) {
+		in->failed = 1;
+		return 0;
+	}
+	return nr;
+}
+
+static const char *get_bytes(struct input *in, size_t *lenp)
+{
+	const char *bytes;
+	size_t len;
+
+	len = get_u32(in);
+	if (in->failed || (size_t)(in->end - in->pos) < len) {
+		in->failed = 1;
+		return NULL;
+	}
+	bytes = in->pos;
+	in->pos += len;
+	*lenp = len;
+	return bytes;
+}
+
+static const char *get_key(struct input *in)
+{
+	const char *bytes;
+	size_t len;
+
+	bytes = get_bytes(in, &len);
+	if (!bytes)
+		return NULL;
+	/* Symbols are C strings */
+	if (memchr(bytes, 0, len)) {
+		in->failed = 1;
+		return NULL;
+	}
+	return __sheep_intern(in->vm, bytes, len);
+}
+
+static sheep_t get_function(struct input *, struct sheep_function *);
+
+static sheep_t get_typeclass(struct input *in)
+{
+	const char *name, **names;
+	unsigned int i, nr_slots;
+
+	name = get_key(in);
+	nr_slots = get_count(in);
+	if (in->failed)
+		return NULL;
+
+	names = sheep_malloc(sizeof(char *) * nr_slots);
+	for (i = 0; i < nr_slots; i++) {
+		names[i] = get_key(in);
+		if (!names[i]) {
+			sheep_free(names);
+			return NULL;
+		}
+	}
+	return sheep_make_typeclass(in->vm, name, names, nr_slots);
+}
+
+static sheep_t get_object(struct input *in)
+{
+	struct sheep_vm *vm = in->vm;
+	const char *bytes;
+	unsigned int nr;
+	sheep_t sheep;
+	double value;
+	size_t len;
+	char *buf;
+	int ret;
+
+	switch (get_u8(in)) {
+	case OBJ_NIL:
+		return &sheep_nil;
+	case OBJ_TRUE:
+		return &sheep_true;
+	case OBJ_FALSE:
+		return &sheep_false;
+	case OBJ_FIXNUM:
+		return sheep_make_number(vm, get_long(in));
+	case OBJ_FLONUM:
+		get(in, &value, sizeof(value));
+		return sheep_make_flonum(vm, value);
+	case OBJ_BIGNUM:
+		bytes = get_bytes(in, &len);
+		if (!bytes)
+			return NULL;
+		buf = sheep_malloc(len + 1);
+		memcpy(buf, bytes, len);
+		buf[len] = 0;
+		ret = sheep_parse_number(vm, buf, &sheep);
+		sheep_free(buf);
+		return ret ? NULL : sheep;
+	case OBJ_STRING:
+		bytes = get_bytes(in, &len);
+		if (!bytes)
+			return NULL;
+		return sheep_copy_string(vm, bytes, len);
+	case OBJ_NAME:
+		bytes = get_key(in);
+		if (!bytes)
+			return NULL;
+		return sheep_make_name(vm, bytes);
+	case OBJ_LIST: {
+		sheep_t list, pos;
+
+		nr = get_count(in);
+		list = pos = sheep_make_cons(vm, NULL, NULL);
+		sheep_protect(vm, list);
+		while (nr--) {
+			sheep = get_object(in);
+			if (!sheep)
+				break;
+			pos = sheep_list_append(vm, pos, sheep);
+		}
+		sheep_unprotect(vm, list);
+		return in->failed ? NULL : list;
+	}
+	case OBJ_VECTOR: {
+		sheep_t array;
+
+		nr = get_count(in);
+		array = sheep_make_array(vm, 0, NULL);
+		sheep_protect(vm, array);
+		while (nr--) {
+			sheep = get_object(in);
+			if (!sheep)
+				break;
+			sheep_array_push(vm, array, sheep);
+		}
+		sheep_unprotect(vm, array);
+		return in->failed ? NULL : array;
+	}
+	case OBJ_FUNCTION:
+		/* Only closures can have free variables */
+		return get_function(in, NULL);
+	case OBJ_TYPECLASS:
+		return get_typeclass(in);
+	}
+	in->failed = 1;
+	return NULL;
+}
+
+static int get_slot(struct input *in, unsigned int *slotp)
+{
+	const char *name;
+	uint32_t index;
+	sheep_t sheep;
+	void *entry;
+
+	switch (get_u8(in)) {
+	case SLOT_MODULE:
+		index = get_u32(in);
+		if (index >= in->slots.nr_items)
+			break;
+		*slotp = (unsigned long)in->slots.items[index];
+		return 0;
+	case SLOT_BUILTIN:
+		name = get_key(in);
+		if (!name || sheep_map_get(&in->vm->builtins, name, &entry))
+			break;
+		*slotp = (unsigned long)entry;
+		return 0;
+	case SLOT_CONSTANT:
+		sheep = get_object(in);
+		if (!sheep)
+			break;
+		*slotp = sheep_vm_constant(in->vm, sheep);
+		return 0;
+	}
+	in->failed = 1;
+	return -1;
+}
+
+/* The template of a closure created by @parent */
+static int get_closure(struct input *in,
+		       struct sheep_function *parent,
+		       unsigned int *slotp)
+{
+	sheep_t sheep;
+
+	if (get_u8(in) != SLOT_CONSTANT || get_u8(in) != OBJ_FUNCTION)
+		goto err;
+	sheep = get_function(in, parent);
+	if (!sheep)
+		goto err;
+	*slotp = sheep_vm_constant(in->vm, sheep);
+	return 0;
+err:
+	in->failed = 1;
+	return -1;
+}
+
+static int get_code(struct input *in, struct sheep_function *function)
+{
+	struct sheep_code *code = &function->code;
+	unsigned int i, nr_code, nr_foreign = 0;
+
+	if (function->foreign)
+		nr_foreign = function->foreign->nr_items;
+
+	nr_code = get_count(in);
+	for (i = 0; i < nr_code; i++) {
+		enum sheep_opcode op;
+		const char *key;
+		unsigned int arg;
+
+		op = get_u8(in);
+		switch (op) {
+		case SHEEP_GLOBAL:
+		case SHEEP_SET_GLOBAL:
+		case SHEEP_ADD:
+		case SHEEP_SUB:
+		case SHEEP_MUL:
+		case SHEEP_LT:
+		case SHEEP_LE:
+		case SHEEP_EQ:
+			if (get_slot(in, &arg))
+				return -1;
+			break;
+		case SHEEP_CLOSURE:
+			if (get_closure(in, function, &arg))
+				return -1;
+			break;
+		case SHEEP_FOREIGN:
+		case SHEEP_SET_FOREIGN:
+			arg = get_u32(in);
+			if (arg >= nr_foreign)
+				return -1;
+			break;
+		case SHEEP_HASH:
+		case SHEEP_SET_HASH:
+		case SHEEP_LOAD:
+			key = get_key(in);
+			if (!key)
+				return -1;
+			arg = sheep_vm_key(in->vm, key);
+			break;
+		case SHEEP_BRT:
+		case SHEEP_BRF:
+		case SHEEP_BR:
+			arg = get_u32(in);
+			if (i + arg > nr_code)
+				return -1;
+			arg = sheep_vector_push(&code->labels,
+						(void *)(unsigned long)(i + arg));
+			break;
+		default:
+			/* Superinstructions are only made on finalization */
+			if (op >= SHEEP_LOCAL_LOCAL)
+				return -1;
+			arg = get_u32(in);
+		}
+		sheep_emit(code, op, arg);
+	}
+	return in->failed ? -1 : 0;
+}
+
+/*
+ * The free variables of a closure refer to the locals of @parent,
+ * or relay through its free variables.
+ */
+static int check_freevar(struct input *in,
+			 struct sheep_function *parent,
+			 struct sheep_freevar *freevar)
+{
+	if (!parent || !freevar->dist)
+		return -1;
+	if (freevar->dist == 1)
+		return freevar->slot < parent->nr_locals ? 0 : -1;
+	if (!parent->foreign || freevar->slot >= parent->foreign->nr_items)
+		return -1;
+	return 0;
+}
+
+/* A function, or the template of a closure created by @parent */
+static sheep_t get_function(struct input *in, struct sheep_function *parent)
+{
+	struct sheep_function *function;
+	unsigned int i, nr;
+	sheep_t sheep;
+
+	/* Allocated first, so that failures are cleaned up by the GC */
+	function = sheep_zalloc(sizeof(struct sheep_function));
+	sheep = sheep_make_object(in->vm, &sheep_function_type, function);
+	sheep_protect(in->vm, sheep);
+
+	if (get_u8(in))
+		function->name = get_key(in);
+	function->filename = in->filename;
+	function->nr_locals = get_u32(in);
+	function->nr_parms = get_u32(in);
+	if (function->nr_parms > function->nr_locals ||
+	    function->nr_locals > in->max_locals)
+		goto err;
+
+	nr = get_count(in);
+	if (nr)
+		function->foreign = sheep_zalloc(sizeof(struct sheep_vector));
+	for (i = 0; i < nr; i++) {
+		struct sheep_freevar *freevar;
+
+		freevar = sheep_malloc(sizeof(struct sheep_freevar));
+		freevar->dist = get_u32(in);
+		freevar->slot = get_u32(in);
+		sheep_vector_push(function->foreign, freevar);
+		if (check_freevar(in, parent, freevar))
+			goto err;
+	}
+
+	nr = get_count(in);
+	for (i = 0; i < nr; i++)
+		sheep_vector_push(&function->code.lines,
+				  (void *)get_long(in));
+
+	if (in->failed || get_code(in, function))
+		goto err;
+	sheep_code_finalize(&function->code);
+	if (sheep_code_analyze(&function->code, function->nr_locals,
+			       &function->max_stack))
+		goto err;
+
+	sheep_unprotect(in->vm, sheep);
+	return sheep;
+err:
+	in->failed = 1;
+	sheep_unprotect(in->vm, sheep);
+	return NULL;
+}
+
+static char *read_file(const char *path, size_t *sizep)
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+		goto err;
+	buf = sheep_malloc(st.st_size + 1);
+	if (read(fd, buf, st.st_size) != st.st_size) {
+		sheep_free(buf);
+		goto err;
+	}
+	close(fd);
+	*sizep = st.st_size;
+	return buf;
+err:
+	close(fd);
+	return NULL;
+}
+
+/*
+ * Load the forms of @mod from the cache at @path, if it is fresh
+ * for the source file @filename with @hash and @size.  Returns a
+ * vector of the toplevel functions to evaluate in order, or NULL if
+ * the cache can not be used.
+ */
+sheep_t sheep_bytecode_load(struct sheep_vm *vm,
+			    struct sheep_module *mod,
+			    const char *path,
+			    const char *filename,
+			    unsigned long hash,
+			    size_t size)
+{
+	struct sheep_vector bindings = { 0 };
+	struct sheep_bytecode header;
+	sheep_t forms = NULL;
+	struct input in;
+	unsigned long i;
+	unsigned long checksum;
+	unsigned int nr_globals;
+	size_t nr_bytes;
+	unsigned int nr;
+	char *buf;
+
+	buf = read_file(path, &nr_bytes);
+	if (!buf)
+		return NULL;
+
+	memset(&header, 0, sizeof(header));
+	put_header(&header, hash, size);
+	if (nr_bytes < header.nr_bytes ||
+	    memcmp(buf, header.bytes, header.nr_bytes))
+		goto out;
+
+	memset(&in, 0, sizeof(in));
+	in.vm = vm;
+	in.filename = sheep_intern(vm, filename);
+	in.pos = buf + header.nr_bytes;
+	in.end = buf + nr_bytes;
+	/* Every local is named somewhere in the source */
+	in.max_locals = size;
+	for (i = 0; i < mod->globals.nr_items; i += 2)
+		sheep_vector_push(&in.slots, mod->globals.items[i]);
+
+	nr = get_count(&in);
+	checksum = get_long(&in);
+	if (in.failed || sheep_hash(in.pos, in.end - in.pos) != checksum)
+		goto out_input;
+
+	forms = sheep_make_array(vm, 0, NULL);
+	sheep_protect(vm, forms);
+
+	/*
+	 * Global slots are handed out while loading, but nothing
+	 * else allocates them meanwhile, so a rejected cache gives
+	 * them back by truncating the globals again.
+	 */
+	nr_globals = vm->globals.nr_items;
+
+	while (nr-- && !in.failed) {
+		unsigned int nr_bindings;
+		sheep_t function;
+
+		/* The bindings take effect once everything is loaded */
+		nr_bindings = get_count(&in);
+		while (nr_bindings--) {
+			const char *name = get_key(&in);
+			unsigned int slot;
+
+			if (!name)
+				break;
+			slot = sheep_vm_global(vm);
+			sheep_vector_push(&in.slots, (void *)(unsigned long)slot);
+			sheep_vector_push(&bindings, (void *)(unsigned long)slot);
+			sheep_vector_push(&bindings, (void *)name);
+		}
+
+		function = get_function(&in, NULL);
+		if (function)
+			sheep_array_push(vm, forms, function);
+	}
+
+	sheep_unprotect(vm, forms);
+	if (in.failed || in.pos != in.end) {
+		vm->globals.nr_items = nr_globals;
+		forms = NULL;
+		goto out_input;
+	}
+
+	for (i = 0; i < bindings.nr_items; i += 2) {
+		unsigned long slot = (unsigned long)bindings.items[i];
+		const char *name = bindings.items[i + 1];
+
+		sheep_map_set(&mod->env, name, (void *)slot);
+		sheep_module_global(mod, slot, name);
+	}
+out_input:
+	sheep_free(bindings.items);
+	sheep_free(in.slots.items);
+out:
+	sheep_free(header.bytes);
+	sheep_free(buf);
+	return forms;
+}
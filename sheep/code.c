@@ -7,6 +7,7 @@
 #include <sheep/foreign.h>
 #include <sheep/object.h>
 #include <sheep/string.h>
+#include <sheep/eval.h>
 #include <sheep/vm.h>
 #include <stdio.h>
 
@@ -24,35 +25,325 @@ void sheep_code_label(struct sheep_code *code, unsigned long jump)
 	code->labels.items[jump] = (void *)offset;
 }
 
+/*
+ * Attribute the code emitted from now on to source @line.  Returns
+ * the line in effect before, 0 if there was none.
+ */
+unsigned long sheep_code_line(struct sheep_code *code, unsigned long line)
+{
+	unsigned long offset = code->code.nr_items, last;
+	struct sheep_vector *lines = &code->lines;
+
+	if (!lines->nr_items) {
+		if (line) {
+			sheep_vector_push(lines, (void *)offset);
+			sheep_vector_push(lines, (void *)line);
+		}
+		return 0;
+	}
+
+	last = (unsigned long)lines->items[lines->nr_items - 1];
+	if (line == last)
+		return last;
+	if ((unsigned long)lines->items[lines->nr_items - 2] == offset)
+		lines->items[lines->nr_items - 1] = (void *)line;
+	else {
+		sheep_vector_push(lines, (void *)offset);
+		sheep_vector_push(lines, (void *)line);
+	}
+	return last;
+}
+
+/* The source line of the instruction at @offset, 0 if unknown */
+unsigned long sheep_code_lineno(struct sheep_code *code, unsigned long offset)
+{
+	unsigned long low = 0, high = code->lines.nr_items / 2;
+
+	while (low < high) {
+		unsigned long mid = (low + high) / 2;
+
+		if ((unsigned long)code->lines.items[mid * 2] <= offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (!low)
+		return 0;
+	return (unsigned long)code->lines.items[(low - 1) * 2 + 1];
+}
+
+/*
+ * Superinstructions execute a common sequence of instructions with a
+ * single dispatch.  The fused opcode replaces only the first
+ * instruction of the sequence, the others stay in place: the
+ * evaluator reads their arguments from there and then skips them,
+ * and branches into the middle of a sequence still work.
+ */
+static const struct sheep_fusion {
+	enum sheep_opcode fused;
+	unsigned int length;
+	enum sheep_opcode ops[3];
+} fusions[] = {
+	{ SHEEP_LOCAL_LOCAL, 2, { SHEEP_LOCAL, SHEEP_LOCAL } },
+	{ SHEEP_SET_LOCAL_POP, 3, { SHEEP_DUP, SHEEP_SET_LOCAL, SHEEP_DROP } },
+	{ SHEEP_CALL_GLOBAL, 2, { SHEEP_GLOBAL, SHEEP_CALL } },
+	{ SHEEP_TAILCALL_GLOBAL, 2, { SHEEP_GLOBAL, SHEEP_TAILCALL } },
+	{ SHEEP_BRF_DROP, 2, { SHEEP_BRF, SHEEP_DROP } },
+};
+
+#define NR_FUSIONS	(sizeof(fusions) / sizeof(fusions[0]))
+
+static const struct sheep_fusion *fusion(enum sheep_opcode op)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_FUSIONS; i++)
+		if (fusions[i].fused == op)
+			return &fusions[i];
+	return NULL;
+}
+
+/* The instruction that a superinstruction has replaced */
+static enum sheep_opcode plain_op(enum sheep_opcode op)
+{
+	const struct sheep_fusion *f = fusion(op);
+
+	return f ? f->ops[0] : op;
+}
+
+static void fuse(struct sheep_insn *insns, unsigned long nr)
+{
+	unsigned long offset = 0;
+
+	while (offset < nr) {
+		unsigned int i, j, length = 1;
+
+		for (i = 0; i < NR_FUSIONS; i++) {
+			const struct sheep_fusion *f = &fusions[i];
+
+			if (offset + f->length > nr)
+				continue;
+			for (j = 0; j < f->length; j++)
+				if (insns[offset + j].op != f->ops[j])
+					break;
+			if (j < f->length)
+				continue;
+
+			insns[offset].op = f->fused;
+			insns[offset].handler = sheep_eval_handler(f->fused);
+			length = f->length;
+			break;
+		}
+		offset += length;
+	}
+}
+
+/* Modules and typeclasses share the id space of the inline caches */
+unsigned long sheep_cache_id(void)
+{
+	static unsigned long ids;
+
+	return ++ids;
+}
+
+/*
+ * Resolve the branch labels and decode the instructions once, into
+ * the (handler, argument) form the evaluator dispatches on, set up
+ * the inline caches and fuse superinstructions.
+ */
 void sheep_code_finalize(struct sheep_code *code)
 {
+	unsigned int nr_caches = 0;
 	unsigned long offset;
 
 	sheep_emit(code, SHEEP_RET, 0);
 	for (offset = 0; offset < code->code.nr_items; offset++) {
-		unsigned long label, insn;
 		enum sheep_opcode op;
 		unsigned int arg;
 
-		insn = (unsigned long)code->code.items[offset];
-		sheep_decode(insn, &op, &arg);
+		sheep_decode((unsigned long)code->code.items[offset], &op, &arg);
+		if (op == SHEEP_HASH || op == SHEEP_SET_HASH)
+			nr_caches++;
+	}
+	if (nr_caches)
+		code->caches = sheep_zalloc(sizeof(struct sheep_cache) *
+					    nr_caches);
+	nr_caches = 0;
 
-		if (op != SHEEP_BRT && op != SHEEP_BRF && op != SHEEP_BR)
-			continue;
+	code->insns = sheep_malloc(sizeof(struct sheep_insn) *
+				code->code.nr_items);
+	for (offset = 0; offset < code->code.nr_items; offset++) {
+		struct sheep_insn *insn = &code->insns[offset];
+		enum sheep_opcode op;
+		unsigned long label;
+		unsigned int arg;
+
+		sheep_decode((unsigned long)code->code.items[offset], &op, &arg);
+
+		if (op == SHEEP_BRT || op == SHEEP_BRF || op == SHEEP_BR) {
+			label = (unsigned long)code->labels.items[arg];
+			arg = label - offset;
+			code->code.items[offset] =
+				(void *)sheep_encode(op, arg);
+		}
 
-		label = (unsigned long)code->labels.items[arg];
-		insn = sheep_encode(op, label - offset);
+		if (op == SHEEP_HASH || op == SHEEP_SET_HASH) {
+			code->caches[nr_caches].key = arg;
+			arg = nr_caches++;
+		}
+
+		insn->handler = sheep_eval_handler(op);
+		insn->op = op;
+		insn->arg = arg;
+	}
+	fuse(code->insns, code->code.nr_items);
+}
 
-		code->code.items[offset] = (void *)insn;
+/* Operand stack items consumed and produced by an instruction */
+static void stack_effect(enum sheep_opcode op,
+			 unsigned int arg,
+			 int *pops,
+			 int *pushes)
+{
+	*pops = *pushes = 0;
+	switch (op) {
+	case SHEEP_LOCAL:
+	case SHEEP_FOREIGN:
+	case SHEEP_GLOBAL:
+	case SHEEP_CLOSURE:
+	case SHEEP_LOAD:
+		*pushes = 1;
+		break;
+	case SHEEP_DROP:
+	case SHEEP_SET_LOCAL:
+	case SHEEP_SET_FOREIGN:
+	case SHEEP_SET_GLOBAL:
+	case SHEEP_RET:
+		*pops = 1;
+		break;
+	case SHEEP_DUP:
+		*pops = 1;
+		*pushes = 2;
+		break;
+	case SHEEP_HASH:
+	case SHEEP_BRT:
+	case SHEEP_BRF:
+		*pops = *pushes = 1;
+		break;
+	case SHEEP_SET_HASH:
+		*pops = 2;
+		break;
+	case SHEEP_ADD:
+	case SHEEP_SUB:
+	case SHEEP_MUL:
+	case SHEEP_LT:
+	case SHEEP_LE:
+	case SHEEP_EQ:
+		*pops = 2;
+		*pushes = 1;
+		break;
+	case SHEEP_CALL:
+	case SHEEP_TAILCALL:
+		*pops = arg + 1;
+		*pushes = 1;
+		break;
+	default:
+		break;
 	}
 }
 
+/*
+ * Compute the maximum operand stack depth of finalized code, on top
+ * of the @nr_locals local slots, and check that the code is sound:
+ * local slots and branch targets are within bounds, the stack never
+ * underflows, every instruction is reached with the same depth on
+ * all paths, and functions return with exactly one item.
+ *
+ * Returns -1 for malformed code.
+ */
+int sheep_code_analyze(struct sheep_code *code,
+		       unsigned int nr_locals,
+		       unsigned int *max_depthp)
+{
+	unsigned long offset, nr = code->code.nr_items;
+	int depth, max = 0, *depths, ret = -1;
+
+	/* The depth each instruction is reached with, -1 if not yet */
+	depths = sheep_malloc(sizeof(int) * nr);
+	for (offset = 0; offset < nr; offset++)
+		depths[offset] = -1;
+	depths[0] = 0;
+
+	for (offset = 0; offset < nr; offset++) {
+		struct sheep_insn *insn = &code->insns[offset];
+		int pops, pushes, falls = 1;
+		enum sheep_opcode op;
+
+		depth = depths[offset];
+		if (depth < 0)
+			continue;	/* unreachable */
+
+		/* Superinstructions are checked as their parts */
+		op = plain_op(insn->op);
+		stack_effect(op, insn->arg, &pops, &pushes);
+		if (depth < pops)
+			goto out;
+		depth += pushes - pops;
+		if (depth > max)
+			max = depth;
+
+		switch (op) {
+		case SHEEP_LOCAL:
+		case SHEEP_SET_LOCAL:
+			if (insn->arg >= nr_locals)
+				goto out;
+			break;
+		case SHEEP_BRT:
+		case SHEEP_BRF:
+		case SHEEP_BR:
+			if (!insn->arg || offset + insn->arg >= nr)
+				goto out;
+			if (depths[offset + insn->arg] < 0)
+				depths[offset + insn->arg] = depth;
+			else if (depths[offset + insn->arg] != depth)
+				goto out;
+			falls = op != SHEEP_BR;
+			break;
+		case SHEEP_RET:
+			if (depth)
+				goto out;
+			falls = 0;
+			break;
+		default:
+			break;
+		}
+
+		if (!falls)
+			continue;
+		if (offset + 1 == nr)
+			goto out;
+		if (depths[offset + 1] < 0)
+			depths[offset + 1] = depth;
+		else if (depths[offset + 1] != depth)
+			goto out;
+	}
+
+	*max_depthp = max;
+	ret = 0;
+out:
+	sheep_free(depths);
+	return ret;
+}
+
 static const char *opnames[] = {
 	"DROP", "DUP", "LOCAL", "SET_LOCAL", "FOREIGN", "SET_FOREIGN",
 	"GLOBAL", "SET_GLOBAL", "HASH", "SET_HASH",
 	"CLOSURE", "CALL", "TAILCALL", "RET",
 	"BRT", "BRF", "BR",
 	"LOAD",
+	"ADD", "SUB", "MUL", "LT", "LE", "EQ",
+	"LOCAL_LOCAL", "SET_LOCAL_POP", "CALL_GLOBAL", "TAILCALL_GLOBAL",
+	"BRF_DROP",
 };
 
 void sheep_code_dump(struct sheep_vm *vm,
@@ -61,6 +352,7 @@ void sheep_code_dump(struct sheep_vm *vm,
 		     enum sheep_opcode op, unsigned int arg)
 {
 	struct sheep_indirect *indirect;
+	const char *key;
 	sheep_t sheep;
 	char *str;
 
@@ -79,11 +371,18 @@ void sheep_code_dump(struct sheep_vm *vm,
 		break;
 	case SHEEP_GLOBAL:
 	case SHEEP_CLOSURE:
+	case SHEEP_ADD:
+	case SHEEP_SUB:
+	case SHEEP_MUL:
+	case SHEEP_LT:
+	case SHEEP_LE:
+	case SHEEP_EQ:
 		sheep = vm->globals.items[arg];
 		break;
 	case SHEEP_HASH:
 	case SHEEP_SET_HASH:
-		printf("; %s\n", vm->keys[arg]);
+		key = vm->keys.items[function->code.caches[arg].key];
+		printf("; %s\n", key);
 		return;
 	default:
 		puts("");
@@ -95,15 +394,30 @@ void sheep_code_dump(struct sheep_vm *vm,
 	sheep_free(str);
 }
 
+/*
+ * Instructions covered by a superinstruction are shown indented,
+ * cached instructions show their key slot.
+ */
 void sheep_code_disassemble(struct sheep_code *code)
 {
-	unsigned long *codep = (unsigned long *)code->code.items;
-	enum sheep_opcode op;
-	unsigned int arg;
-
-	do {
-		sheep_decode(*codep, &op, &arg);
-		printf("  %-12s %5u\n", opnames[op], arg);
-		codep++;
-	} while (op != SHEEP_RET);
+	unsigned long offset;
+	unsigned int covered = 0;
+
+	for (offset = 0; offset < code->code.nr_items; offset++) {
+		struct sheep_insn *insn = &code->insns[offset];
+		const struct sheep_fusion *f;
+		unsigned int arg = insn->arg;
+
+		if (insn->op == SHEEP_HASH || insn->op == SHEEP_SET_HASH)
+			arg = code->caches[arg].key;
+		if (covered) {
+			printf("    %-14s %5u\n", opnames[insn->op], arg);
+			covered--;
+			continue;
+		}
+		printf("  %-16s %5u\n", opnames[insn->op], arg);
+		f = fusion(insn->op);
+		if (f)
+			covered = f->length - 1;
+	}
 }
@@ -6,6 +6,7 @@
 #include <sheep/function.h>
 #include <sheep/foreign.h>
 #include <sheep/vector.h>
+#include <sheep/array.h>
 #include <sheep/parse.h>
 #include <sheep/code.h>
 #include <sheep/list.h>
@@ -15,6 +16,7 @@
 #include <sheep/map.h>
 #include <sheep/gc.h>
 #include <sheep/vm.h>
+#include <string.h>
 
 #include <sheep/compile.h>
 
@@ -36,6 +38,7 @@ sheep_t __sheep_compile(struct sheep_vm *vm,
 	sheep_protect(vm, expr->object);
 
 	function = sheep_zalloc(sizeof(struct sheep_function));
+	function->filename = expr->filename;
 	err = sheep_compile_object(&compile, function, &context, expr->object);
 	if (err) {
 		sheep_code_exit(&function->code);
@@ -44,7 +47,7 @@ sheep_t __sheep_compile(struct sheep_vm *vm,
 		sheep_unprotect(vm, expr->object);
 		return NULL;
 	}
-	sheep_code_finalize(&function->code);
+	sheep_function_finalize(function);
 
 	sheep_unprotect(vm, expr->object);
 	return sheep_make_object(vm, &sheep_function_type, function);
@@ -66,7 +69,8 @@ enum env_level {
 	ENV_NONE,
 	ENV_LOCAL,
 	ENV_GLOBAL,
-	ENV_FOREIGN
+	ENV_FOREIGN,
+	ENV_BUILTIN
 };
 
 static enum env_level lookup_env(struct sheep_compile *compile,
@@ -83,7 +87,8 @@ static enum env_level lookup_env(struct sheep_compile *compile,
 		if (!current->parent) {
 			if (sheep_map_get(&compile->vm->builtins, name, &entry))
 				return ENV_NONE;
-			break;
+			*slot = (unsigned long)entry;
+			return ENV_BUILTIN;
 		}
 		if (current->flags & SHEEP_CONTEXT_FUNCTION)
 			distance++;
@@ -100,6 +105,32 @@ static enum env_level lookup_env(struct sheep_compile *compile,
 	return ENV_FOREIGN;
 }
 
+static const struct sheep_operator {
+	const char *name;
+	enum sheep_opcode op;
+} operators[] = {
+	{ "+", SHEEP_ADD },
+	{ "-", SHEEP_SUB },
+	{ "*", SHEEP_MUL },
+	{ "<", SHEEP_LT },
+	{ "<=", SHEEP_LE },
+	{ "=", SHEEP_EQ },
+};
+
+/*
+ * The compiler inlines the operators and compiles vector literals to
+ * calls of the vector builtin, so these builtins can not be set.
+ */
+static int fixed_builtin(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+		if (!strcmp(operators[i].name, name))
+			return 1;
+	return !strcmp(name, "vector");
+}
+
 static int compile_name(struct sheep_compile *compile,
 			struct sheep_function *function,
 			struct sheep_context *context,
@@ -123,6 +154,13 @@ static int compile_name(struct sheep_compile *compile,
 		else
 			sheep_emit(&function->code, SHEEP_LOCAL, slot);
 		break;
+	case ENV_BUILTIN:
+		if (set && name->nr_parts == 1 &&
+		    fixed_builtin(name->parts[0])) {
+			sheep_parser_error(compile, sheep, "can not set builtin");
+			return -1;
+		}
+		/* fall through */
 	case ENV_GLOBAL:
 		if (set && name->nr_parts == 1)
 			sheep_emit(&function->code, SHEEP_SET_GLOBAL, slot);
@@ -173,6 +211,39 @@ int sheep_compile_set(struct sheep_compile *compile,
 	return compile_name(compile, function, context, sheep, 1);
 }
 
+/*
+ * Binary calls to some builtins get their own instruction, which
+ * handles fixnums inline and calls the builtin otherwise.
+ */
+static int lookup_operator(struct sheep_compile *compile,
+			   struct sheep_context *context,
+			   sheep_t callable,
+			   int nargs,
+			   enum sheep_opcode *op,
+			   unsigned int *slot)
+{
+	struct sheep_name *name;
+	unsigned int i, dist;
+
+	if (nargs != 2 || sheep_type(callable) != &sheep_name_type)
+		return 0;
+
+	name = sheep_name(callable);
+	if (name->nr_parts != 1)
+		return 0;
+
+	for (i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+		if (strcmp(operators[i].name, name->parts[0]))
+			continue;
+		if (lookup_env(compile, context, name->parts[0],
+			       &dist, slot) != ENV_BUILTIN)
+			return 0;
+		*op = operators[i].op;
+		return 1;
+	}
+	return 0;
+}
+
 static int compile_call(struct sheep_compile *compile,
 			struct sheep_function *function,
 			struct sheep_context *context,
@@ -183,15 +254,22 @@ static int compile_call(struct sheep_compile *compile,
 		.env = &env,
 		.parent = context,
 	};
+	unsigned int tail, slot;
 	struct sheep_list *args;
+	enum sheep_opcode op;
 	int nargs, ret = -1;
-	unsigned int tail;
 
 	args = sheep_list(form->tail);
 	for (nargs = 0; args->head; args = sheep_list(args->tail), nargs++)
 		if (sheep_compile_object(compile, function, &block, args->head))
 			goto out;
 
+	if (lookup_operator(compile, context, form->head, nargs, &op, &slot)) {
+		sheep_emit(&function->code, op, slot);
+		ret = 0;
+		goto out;
+	}
+
 	/* Do not propagate to subcalls as in call to foo in ((foo x) n) */
 	tail = context->flags & SHEEP_CONTEXT_TAILFORM;
 	context->flags &= ~SHEEP_CONTEXT_TAILFORM;
@@ -214,7 +292,9 @@ int sheep_compile_list(struct sheep_compile *compile,
 		       struct sheep_context *context,
 		       sheep_t sheep)
 {
+	unsigned long line, outer;
 	struct sheep_list *list;
+	int ret;
 
 	list = sheep_list(sheep);
 
@@ -222,6 +302,10 @@ int sheep_compile_list(struct sheep_compile *compile,
 	if (!list->head)
 		return sheep_compile_constant(compile, function, context, sheep);
 
+	/* Record the form's line, the enclosing form continues after it */
+	line = sheep_expr_line(compile->expr, sheep);
+	outer = sheep_code_line(&function->code, line);
+
 	if (sheep_type(list->head) == &sheep_name_type) {
 		struct sheep_name *name;
 		void *entry;
@@ -234,8 +318,46 @@ int sheep_compile_list(struct sheep_compile *compile,
 					struct sheep_context *,
 					struct sheep_list *) = entry;
 
-			return compile_special(compile, function, context, list);
+			ret = compile_special(compile, function, context, list);
+			goto out;
 		}
 	}
-	return compile_call(compile, function, context, list);
+	ret = compile_call(compile, function, context, list);
+out:
+	if (outer)
+		sheep_code_line(&function->code, outer);
+	return ret;
+}
+
+/* A vector literal [item*] builds a new vector, like (vector item*) */
+int sheep_compile_array(struct sheep_compile *compile,
+			struct sheep_function *function,
+			struct sheep_context *context,
+			sheep_t sheep)
+{
+	SHEEP_DEFINE_MAP(env);
+	struct sheep_context block = {
+		.env = &env,
+		.parent = context,
+	};
+	struct sheep_vector *array;
+	unsigned long i;
+	void *entry;
+	int ret = -1;
+
+	array = sheep_array(sheep);
+	for (i = 0; i < array->nr_items; i++)
+		if (sheep_compile_object(compile, function, &block,
+					 array->items[i]))
+			goto out;
+
+	/* The vector builtin can not be set, see fixed_builtin() */
+	sheep_map_get(&compile->vm->builtins,
+		      sheep_intern(compile->vm, "vector"), &entry);
+	sheep_emit(&function->code, SHEEP_GLOBAL, (unsigned long)entry);
+	sheep_emit(&function->code, SHEEP_CALL, array->nr_items);
+	ret = 0;
+out:
+	sheep_map_drain(&env);
+	return ret;
 }
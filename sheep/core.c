@@ -173,6 +173,7 @@ static void compile_set_return(struct sheep_compile *compile,
 	} else {
 		slot = sheep_vm_global(compile->vm);
 		sheep_emit(&function->code, SHEEP_SET_GLOBAL, slot);
+		sheep_module_global(compile->module, slot, name);
 	}
 	sheep_map_set(context->env, name, (void *)(unsigned long)slot);
 }
@@ -231,6 +232,7 @@ static int compile_function(struct sheep_compile *compile,
 
 	sheep = sheep_make_function(compile->vm, name);
 	childfun = sheep_data(sheep);
+	childfun->filename = compile->expr->filename;
 
 	while (parms->head) {
 		struct sheep_list *rest;
@@ -265,7 +267,7 @@ static int compile_function(struct sheep_compile *compile,
 			sheep_map_del(context->env, name);
 		goto out;
 	}
-	sheep_code_finalize(&childfun->code);
+	sheep_function_finalize(childfun);
 	if (childfun->foreign)
 		sheep_foreign_propagate(function, childfun);
 out:
@@ -296,7 +298,7 @@ static int compile_type(struct sheep_compile *compile,
 			goto err;
 
 		slotnames = sheep_realloc(slotnames, sizeof(char *) * ++nr_slots);
-		slotnames[nr_slots - 1] = sheep_strdup(slotname);
+		slotnames[nr_slots - 1] = slotname;
 	} while (names->head);
 
 	class = sheep_make_typeclass(compile->vm, name, slotnames, nr_slots);
@@ -307,8 +309,6 @@ static int compile_type(struct sheep_compile *compile,
 
 	return 0;
 err:
-	while (nr_slots--)
-		sheep_free(slotnames[nr_slots]);
 	sheep_free(slotnames);
 	return -1;
 }
@@ -477,19 +477,24 @@ static int compile_load(struct sheep_compile *compile,
 	return 0;
 }
 
+static void special(struct sheep_vm *vm, const char *name, void *compile)
+{
+	sheep_map_set(&vm->specials, sheep_intern(vm, name), compile);
+}
+
 void sheep_core_init(struct sheep_vm *vm)
 {
-	sheep_map_set(&vm->specials, "quote", compile_quote);
-	sheep_map_set(&vm->specials, "block", compile_block);
-	sheep_map_set(&vm->specials, "with", compile_with);
-	sheep_map_set(&vm->specials, "variable", compile_variable);
-	sheep_map_set(&vm->specials, "function", compile_function);
-	sheep_map_set(&vm->specials, "type", compile_type);
-	sheep_map_set(&vm->specials, "or", compile_or);
-	sheep_map_set(&vm->specials, "and", compile_and);
-	sheep_map_set(&vm->specials, "if", compile_if);
-	sheep_map_set(&vm->specials, "set", compile_set);
-	sheep_map_set(&vm->specials, "load", compile_load);
+	special(vm, "quote", compile_quote);
+	special(vm, "block", compile_block);
+	special(vm, "with", compile_with);
+	special(vm, "variable", compile_variable);
+	special(vm, "function", compile_function);
+	special(vm, "type", compile_type);
+	special(vm, "or", compile_or);
+	special(vm, "and", compile_and);
+	special(vm, "if", compile_if);
+	special(vm, "set", compile_set);
+	special(vm, "load", compile_load);
 }
 
 void sheep_core_exit(struct sheep_vm *vm)
@@ -4,7 +4,9 @@
  * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
  */
 #include <sheep/function.h>
+#include <sheep/config.h>
 #include <sheep/foreign.h>
+#include <sheep/number.h>
 #include <sheep/object.h>
 #include <sheep/string.h>
 #include <sheep/alien.h>
@@ -22,36 +24,73 @@
 
 #include <sheep/eval.h>
 
+/*
+ * The slot of a module member or typeobject value, if @cache knows
+ * the module or the class of the object
+ */
+static inline sheep_t *cached(struct sheep_vm *vm,
+			      sheep_t container,
+			      struct sheep_cache *cache)
+{
+	const struct sheep_type *type = sheep_type(container);
+
+	if (type == &sheep_typeobject_type) {
+		struct sheep_typeobject *object = sheep_data(container);
+		struct sheep_typeclass *class = sheep_data(object->class);
+
+		if (class->id != cache->id)
+			return NULL;
+		return &object->values[cache->slot];
+	} else if (type == &sheep_module_type) {
+		struct sheep_module *mod = sheep_data(container);
+
+		if (mod->id != cache->id)
+			return NULL;
+		return (sheep_t *)&vm->globals.items[cache->slot];
+	}
+	return NULL;
+}
+
 static sheep_t hash(struct sheep_vm *vm,
 		    sheep_t container,
-		    unsigned int key_slot,
+		    struct sheep_cache *cache,
 		    sheep_t value)
 {
 	const char *key, *obj;
 	struct sheep_map *map;
+	unsigned long id;
 	sheep_t *slots;
 	void *entry;
 
-	key = vm->keys[key_slot];
+	key = vm->keys.items[cache->key];
 
 	if (sheep_type(container) == &sheep_module_type) {
 		struct sheep_module *mod = sheep_data(container);
 
 		slots = (sheep_t *)vm->globals.items;
 		map = &mod->env;
+		id = mod->id;
 	} else if (sheep_type(container) == &sheep_typeobject_type) {
 		struct sheep_typeobject *object = sheep_data(container);
+		struct sheep_typeclass *class = sheep_data(object->class);
 
 		slots = object->values;
-		map = &object->map;
+		map = &class->slots;
+		id = class->id;
 	} else
 		goto err;
 
 	if (sheep_map_get(map, key, &entry))
 		goto err;
 
-	if (value)
+	/* Modules only ever grow and classes are fixed, slots stay valid */
+	cache->id = id;
+	cache->slot = (unsigned long)entry;
+
+	if (value) {
 		slots[(unsigned long)entry] = value;
+		sheep_write_barrier(vm, container, value);
+	}
 
 	return slots[(unsigned long)entry];
 err:
@@ -106,223 +145,428 @@ static void splice_arguments(struct sheep_vm *vm,
 	vm->stack.nr_items = basep + nr_args;
 }
 
+/* Reserve the whole frame of @function and set up its locals */
 static unsigned long finalize_frame(struct sheep_vm *vm,
 				    struct sheep_function *function)
 {
 	unsigned int nr;
 
 	nr = function->nr_locals - function->nr_parms;
-	if (nr)
-		sheep_vector_grow(&vm->stack, nr);
+	sheep_vector_reserve(&vm->stack, nr + function->max_stack);
+	/* Like global slots, see sheep_vm_global() */
+	while (nr--)
+		vm->stack.items[vm->stack.nr_items++] = &sheep_nil;
 	return vm->stack.nr_items - function->nr_locals;
 }
 
-static unsigned long *function_codep(struct sheep_function *function)
+static struct sheep_insn *function_codep(struct sheep_function *function)
 {
-	return (unsigned long *)function->code.code.items;
+	return function->code.insns;
 }
 
-sheep_t sheep_eval(struct sheep_vm *vm, sheep_t function)
+/*
+ * With SHEEP_THREADED, the instructions carry the address of their
+ * handler and every handler jumps directly to the next one, see
+ * sheep_eval_handler().  Otherwise, a switch on the opcode is used.
+ */
+#if SHEEP_THREADED && defined(__GNUC__)
+#define THREADED
+#endif
+
+#ifdef THREADED
+#define OP(name)	op_##name:
+#define DISPATCH	goto *codep->handler
+#define NEXT		goto *(++codep)->handler
+#else
+#define OP(name)	case SHEEP_##name:
+#define DISPATCH	continue
+#define NEXT		break
+#endif
+
+/*
+ * The evaluator works on a cached stack pointer.  The frame reserves
+ * enough room for the operand stack, so pushes need no checks, but
+ * vm->stack has to be synced before anything that may look at the
+ * stack, collect garbage, or grow the stack.
+ */
+#define PUSH(sheep)	(*sp++ = (sheep))
+#define POP()		(*--sp)
+#define TOP()		(sp[-1])
+#define SAVE_SP()	(vm->stack.nr_items = sp - stack)
+#define LOAD_SP()	do {						\
+		stack = (sheep_t *)vm->stack.items;			\
+		sp = stack + vm->stack.nr_items;			\
+	} while (0)
+
+#define FIXNUMS()	(sheep_is_fixnum(sp[-2]) && sheep_is_fixnum(sp[-1]))
+#define BOOL(cond)	((cond) ? &sheep_true : &sheep_false)
+
+static sheep_t eval(struct sheep_vm *vm, sheep_t function,
+		    const void *const **handlersp)
 {
+	struct sheep_indirect *indirect;
 	struct sheep_function *current;
-	unsigned long basep, *codep;
+	unsigned long basep;
+	struct sheep_insn *codep;
 	unsigned int nesting = 0;
 	sheep_t problem = NULL;
+	sheep_t *stack, *sp, *slot;
+	sheep_t tmp;
+	int done;
+#ifdef THREADED
+	static const void *const handlers[] = {
+		[SHEEP_DROP] = &&op_DROP,
+		[SHEEP_DUP] = &&op_DUP,
+		[SHEEP_LOCAL] = &&op_LOCAL,
+		[SHEEP_SET_LOCAL] = &&op_SET_LOCAL,
+		[SHEEP_FOREIGN] = &&op_FOREIGN,
+		[SHEEP_SET_FOREIGN] = &&op_SET_FOREIGN,
+		[SHEEP_GLOBAL] = &&op_GLOBAL,
+		[SHEEP_SET_GLOBAL] = &&op_SET_GLOBAL,
+		[SHEEP_HASH] = &&op_HASH,
+		[SHEEP_SET_HASH] = &&op_SET_HASH,
+		[SHEEP_CLOSURE] = &&op_CLOSURE,
+		[SHEEP_CALL] = &&op_CALL,
+		[SHEEP_TAILCALL] = &&op_TAILCALL,
+		[SHEEP_RET] = &&op_RET,
+		[SHEEP_BRT] = &&op_BRT,
+		[SHEEP_BRF] = &&op_BRF,
+		[SHEEP_BR] = &&op_BR,
+		[SHEEP_LOAD] = &&op_LOAD,
+		[SHEEP_ADD] = &&op_ADD,
+		[SHEEP_SUB] = &&op_SUB,
+		[SHEEP_MUL] = &&op_MUL,
+		[SHEEP_LT] = &&op_LT,
+		[SHEEP_LE] = &&op_LE,
+		[SHEEP_EQ] = &&op_EQ,
+		[SHEEP_LOCAL_LOCAL] = &&op_LOCAL_LOCAL,
+		[SHEEP_SET_LOCAL_POP] = &&op_SET_LOCAL_POP,
+		[SHEEP_CALL_GLOBAL] = &&op_CALL_GLOBAL,
+		[SHEEP_TAILCALL_GLOBAL] = &&op_TAILCALL_GLOBAL,
+		[SHEEP_BRF_DROP] = &&op_BRF_DROP,
+	};
+
+	if (handlersp) {
+		*handlersp = handlers;
+		return NULL;
+	}
+#endif
 
 	sheep_protect(vm, function);
 
 	current = sheep_function(function);
 	codep = function_codep(current);
 	basep = finalize_frame(vm, current);
+	LOAD_SP();
 
+#ifdef THREADED
+	DISPATCH;
+#else
 	for (;;) {
-		struct sheep_indirect *indirect;
-		enum sheep_opcode op;
-		unsigned int arg;
-		sheep_t tmp;
-		int done;
-
-		sheep_decode(*codep, &op, &arg);
-		//sheep_code_dump(vm, current, basep, op, arg);
-
-		switch (op) {
-		case SHEEP_DROP:
-			sheep_vector_pop(&vm->stack);
-			break;
-		case SHEEP_DUP:
-			tmp = vm->stack.items[vm->stack.nr_items - 1];
-			sheep_vector_push(&vm->stack, tmp);
-			break;
-		case SHEEP_LOCAL:
-			tmp = vm->stack.items[basep + arg];
-			sheep_vector_push(&vm->stack, tmp);
-			break;
-		case SHEEP_SET_LOCAL:
-			tmp = sheep_vector_pop(&vm->stack);
-			vm->stack.items[basep + arg] = tmp;
-			break;
-		case SHEEP_FOREIGN:
-			indirect = current->foreign->items[arg];
-			if (indirect->count < 0)
-				tmp = indirect->value.closed;
-			else {
-				unsigned long index;
-
-				index = indirect->value.live.index;
-				tmp = vm->stack.items[index];
-			}
-			sheep_vector_push(&vm->stack, tmp);
-			break;
-		case SHEEP_SET_FOREIGN:
-			tmp = sheep_vector_pop(&vm->stack);
-			indirect = current->foreign->items[arg];
-			if (indirect->count < 0)
-				indirect->value.closed = tmp;
-			else {
-				unsigned long index;
-
-				index = indirect->value.live.index;
-				vm->stack.items[index] = tmp;
-			}
-			break;
-		case SHEEP_GLOBAL:
-			tmp = vm->globals.items[arg];
-			sheep_vector_push(&vm->stack, tmp);
-			break;
-		case SHEEP_SET_GLOBAL:
-			tmp = sheep_vector_pop(&vm->stack);
-			vm->globals.items[arg] = tmp;
-			break;
-		case SHEEP_HASH:
-			tmp = sheep_vector_pop(&vm->stack);
-			tmp = hash(vm, tmp, arg, NULL);
-			if (!tmp)
-				goto err;
-			sheep_vector_push(&vm->stack, tmp);
-			break;
-		case SHEEP_SET_HASH:
-			tmp = sheep_vector_pop(&vm->stack);
-			if (!hash(vm, tmp, arg, sheep_vector_pop(&vm->stack)))
-				goto err;
-			break;
-		case SHEEP_CLOSURE:
-			tmp = vm->globals.items[arg];
-			tmp = closure(vm, basep, current, tmp);
-			sheep_vector_push(&vm->stack, tmp);
-			break;
-		case SHEEP_TAILCALL:
-			tmp = sheep_vector_pop(&vm->stack);
-
-			done = precall(vm, tmp, arg, &tmp);
-			switch (done) {
-			case SHEEP_CALL_FAIL:
-				problem = tmp;
-				goto err;
-			case SHEEP_CALL_DONE:
-				sheep_vector_push(&vm->stack, tmp);
-				break;
-			case SHEEP_CALL_EVAL:
-				sheep_foreign_save(vm, basep);
-				splice_arguments(vm, basep, arg);
-
-				sheep_unprotect(vm, function);
-				function = tmp;
-				sheep_protect(vm, function);
-
-				current = sheep_function(function);
-				finalize_frame(vm, current);
-				codep = function_codep(current);
-				continue;
-			}
-			break;
-		case SHEEP_CALL:
-			tmp = sheep_vector_pop(&vm->stack);
-
-			done = precall(vm, tmp, arg, &tmp);
-			switch (done) {
-			case SHEEP_CALL_FAIL:
-				problem = tmp;
-				goto err;
-			case SHEEP_CALL_DONE:
-				sheep_vector_push(&vm->stack, tmp);
-				break;
-			case SHEEP_CALL_EVAL:
-				sheep_vector_push(&vm->calls, codep);
-				sheep_vector_push(&vm->calls, (void *)basep);
-				sheep_vector_push(&vm->calls, function);
-
-				sheep_unprotect(vm, function);
-				function = tmp;
-				sheep_protect(vm, function);
-
-				current = sheep_function(function);
-				basep = finalize_frame(vm, current);
-				codep = function_codep(current);
-
-				nesting++;
-				continue;
-			}
+		//sheep_code_dump(vm, current, basep, codep->op, codep->arg);
+		switch (codep->op) {
+#endif
+	OP(DROP)
+		sp--;
+		NEXT;
+	OP(DUP)
+		tmp = TOP();
+		PUSH(tmp);
+		NEXT;
+	OP(LOCAL)
+		PUSH(stack[basep + codep->arg]);
+		NEXT;
+	OP(SET_LOCAL)
+		stack[basep + codep->arg] = POP();
+		NEXT;
+	OP(FOREIGN)
+		indirect = current->foreign->items[codep->arg];
+		if (indirect->count < 0)
+			tmp = indirect->value.closed;
+		else
+			tmp = stack[indirect->value.live.index];
+		PUSH(tmp);
+		NEXT;
+	OP(SET_FOREIGN)
+		tmp = POP();
+		indirect = current->foreign->items[codep->arg];
+		if (indirect->count < 0) {
+			indirect->value.closed = tmp;
+			sheep_remember(vm, tmp);
+		} else
+			stack[indirect->value.live.index] = tmp;
+		NEXT;
+	OP(GLOBAL)
+		PUSH(vm->globals.items[codep->arg]);
+		NEXT;
+	OP(SET_GLOBAL)
+		vm->globals.items[codep->arg] = POP();
+		NEXT;
+	OP(HASH)
+		slot = cached(vm, TOP(), &current->code.caches[codep->arg]);
+		if (slot) {
+			TOP() = *slot;
+			NEXT;
+		}
+		tmp = hash(vm, POP(), &current->code.caches[codep->arg], NULL);
+		if (!tmp)
+			goto err;
+		PUSH(tmp);
+		NEXT;
+	OP(SET_HASH)
+		tmp = POP();
+		slot = cached(vm, tmp, &current->code.caches[codep->arg]);
+		if (slot) {
+			*slot = POP();
+			/* Globals are roots, no write barrier needed */
+			if (sheep_type(tmp) == &sheep_typeobject_type)
+				sheep_write_barrier(vm, tmp, *slot);
+			NEXT;
+		}
+		if (!hash(vm, tmp, &current->code.caches[codep->arg], POP()))
+			goto err;
+		NEXT;
+	OP(CLOSURE)
+		SAVE_SP();
+		tmp = vm->globals.items[codep->arg];
+		tmp = closure(vm, basep, current, tmp);
+		PUSH(tmp);
+		NEXT;
+	OP(TAILCALL)
+		tmp = POP();
+	tailcall:
+		SAVE_SP();
+
+		done = precall(vm, tmp, codep->arg, &tmp);
+		switch (done) {
+		case SHEEP_CALL_FAIL:
+			problem = tmp;
+			goto err;
+		case SHEEP_CALL_DONE:
+			LOAD_SP();
+			PUSH(tmp);
 			break;
-		case SHEEP_RET:
-			sheep_bug_on(vm->stack.nr_items -
-				basep - current->nr_locals != 1);
-
+		case SHEEP_CALL_EVAL:
 			sheep_foreign_save(vm, basep);
-
-			if (current->nr_locals) {
-				vm->stack.items[basep] =
-					vm->stack.items[basep +
-							current->nr_locals];
-				vm->stack.nr_items = basep + 1;
-			}
+			splice_arguments(vm, basep, codep->arg);
 
 			sheep_unprotect(vm, function);
+			function = tmp;
+			sheep_protect(vm, function);
 
-			if (!nesting--)
-				goto out;
+			current = sheep_function(function);
+			finalize_frame(vm, current);
+			LOAD_SP();
+			codep = function_codep(current);
+			DISPATCH;
+		}
+		NEXT;
+	OP(CALL)
+		tmp = POP();
+	call:
+		SAVE_SP();
+
+		done = precall(vm, tmp, codep->arg, &tmp);
+		switch (done) {
+		case SHEEP_CALL_FAIL:
+			problem = tmp;
+			goto err;
+		case SHEEP_CALL_DONE:
+			LOAD_SP();
+			PUSH(tmp);
+			break;
+		case SHEEP_CALL_EVAL:
+			sheep_vector_push(&vm->calls, codep);
+			sheep_vector_push(&vm->calls, (void *)basep);
+			sheep_vector_push(&vm->calls, function);
 
-			function = sheep_vector_pop(&vm->calls);
+			sheep_unprotect(vm, function);
+			function = tmp;
 			sheep_protect(vm, function);
 
 			current = sheep_function(function);
-			basep = (unsigned long)sheep_vector_pop(&vm->calls);
-			codep = sheep_vector_pop(&vm->calls);
-			break;
-		case SHEEP_BRT:
-			tmp = vm->stack.items[vm->stack.nr_items - 1];
-			if (!sheep_test(tmp))
-				break;
-			codep += arg;
-			continue;
-		case SHEEP_BRF:
-			tmp = vm->stack.items[vm->stack.nr_items - 1];
-			if (sheep_test(tmp))
-				break;
-		case SHEEP_BR:
-			codep += arg;
-			continue;
-		case SHEEP_LOAD:
-			tmp = sheep_module_load(vm, vm->keys[arg]);
-			if (!tmp)
-				goto err;
-			sheep_vector_push(&vm->stack, tmp);
-			break;
+			basep = finalize_frame(vm, current);
+			LOAD_SP();
+			codep = function_codep(current);
+
+			nesting++;
+			DISPATCH;
+		}
+		NEXT;
+	OP(RET)
+		sheep_bug_on(sp - stack - basep - current->nr_locals != 1);
+
+		SAVE_SP();
+		sheep_foreign_save(vm, basep);
+
+		if (current->nr_locals) {
+			stack[basep] = stack[basep + current->nr_locals];
+			sp = stack + basep + 1;
+		}
+
+		sheep_unprotect(vm, function);
+
+		if (!nesting--)
+			goto out;
+
+		function = sheep_vector_pop(&vm->calls);
+		sheep_protect(vm, function);
+
+		current = sheep_function(function);
+		basep = (unsigned long)sheep_vector_pop(&vm->calls);
+		codep = sheep_vector_pop(&vm->calls);
+		NEXT;
+	OP(BRT)
+		if (!sheep_test(TOP()))
+			NEXT;
+		codep += codep->arg;
+		DISPATCH;
+	OP(BRF)
+		if (sheep_test(TOP()))
+			NEXT;
+		codep += codep->arg;
+		DISPATCH;
+	OP(BR)
+		codep += codep->arg;
+		DISPATCH;
+	OP(LOAD)
+		SAVE_SP();
+		tmp = sheep_module_load(vm, vm->keys.items[codep->arg]);
+		if (!tmp)
+			goto err;
+		LOAD_SP();
+		PUSH(tmp);
+		NEXT;
+	/*
+	 * Inlined builtins, see compile_call().  Fixnums are handled
+	 * right here, everything else, including overflows, goes to
+	 * the builtin.
+	 */
+	OP(ADD)
+		if (!FIXNUMS() || sheep_fixnum_add(sp[-2], sp[-1], &tmp))
+			goto operator;
+		sp--;
+		TOP() = tmp;
+		NEXT;
+	OP(SUB)
+		if (!FIXNUMS() || sheep_fixnum_sub(sp[-2], sp[-1], &tmp))
+			goto operator;
+		sp--;
+		TOP() = tmp;
+		NEXT;
+	OP(MUL)
+		if (!FIXNUMS() || sheep_fixnum_mul(sp[-2], sp[-1], &tmp))
+			goto operator;
+		sp--;
+		TOP() = tmp;
+		NEXT;
+	OP(LT)
+		if (!FIXNUMS())
+			goto operator;
+		tmp = POP();
+		TOP() = BOOL(sheep_fixnum(TOP()) < sheep_fixnum(tmp));
+		NEXT;
+	OP(LE)
+		if (!FIXNUMS())
+			goto operator;
+		tmp = POP();
+		TOP() = BOOL(sheep_fixnum(TOP()) <= sheep_fixnum(tmp));
+		NEXT;
+	OP(EQ)
+		if (!FIXNUMS())
+			goto operator;
+		tmp = POP();
+		TOP() = BOOL(TOP() == tmp);
+		NEXT;
+	operator:
+		SAVE_SP();
+		tmp = vm->globals.items[codep->arg];
+		if (precall(vm, tmp, 2, &tmp) != SHEEP_CALL_DONE) {
+			problem = tmp;
+			goto err;
+		}
+		LOAD_SP();
+		PUSH(tmp);
+		NEXT;
+	/*
+	 * Superinstructions, see sheep/code.c.  They read the
+	 * arguments of the instructions they cover and skip them.
+	 */
+	OP(LOCAL_LOCAL)
+		PUSH(stack[basep + codep->arg]);
+		codep++;
+		PUSH(stack[basep + codep->arg]);
+		NEXT;
+	OP(SET_LOCAL_POP)
+		codep++;
+		stack[basep + codep->arg] = POP();
+		codep++;
+		NEXT;
+	OP(CALL_GLOBAL)
+		tmp = vm->globals.items[codep->arg];
+		codep++;
+		goto call;
+	OP(TAILCALL_GLOBAL)
+		tmp = vm->globals.items[codep->arg];
+		codep++;
+		goto tailcall;
+	OP(BRF_DROP)
+		if (sheep_test(TOP())) {
+			sp--;
+			codep++;
+			NEXT;
+		}
+		codep += codep->arg;
+		DISPATCH;
+#ifndef THREADED
 		default:
 			abort();
 		}
 		codep++;
 	}
+#endif
 out:
-	return sheep_vector_pop(&vm->stack);
+	tmp = POP();
+	SAVE_SP();
+	return tmp;
 err:
+	/*
+	 * The innermost sheep function tells where the error happened.
+	 * Evaluations nested in builtins may have reported it already.
+	 */
+	if (vm->error && !vm->error_filename && current->filename) {
+		vm->error_lineno = sheep_code_lineno(&current->code,
+						     codep - current->code.insns);
+		if (vm->error_lineno)
+			vm->error_filename = current->filename;
+	}
 	vm->stack.nr_items = 0;
 	vm->calls.nr_items -= 3 * nesting;
-	if (!vm->calls.nr_items)
+	if (!vm->calls.nr_items && vm->error)
 		sheep_report_error(vm, problem);
 	sheep_unprotect(vm, function);
 	return NULL;
 }
 
+sheep_t sheep_eval(struct sheep_vm *vm, sheep_t function)
+{
+	return eval(vm, function, NULL);
+}
+
+/* Handler address of @op for threaded dispatch, NULL otherwise */
+const void *sheep_eval_handler(enum sheep_opcode op)
+{
+#ifdef THREADED
+	static const void *const *handlers;
+
+	if (!handlers)
+		eval(NULL, NULL, &handlers);
+	return handlers[op];
+#else
+	return NULL;
+#endif
+}
+
 static sheep_t call(struct sheep_vm *vm, sheep_t callable, unsigned int nr_args)
 {
 	sheep_t value;
@@ -0,0 +1,145 @@
+/*
+ * sheep/flonum.c
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#include <sheep/compile.h>
+#include <sheep/bignum.h>
+#include <sheep/number.h>
+#include <sheep/object.h>
+#include <sheep/util.h>
+#include <sheep/gc.h>
+#include <sheep/vm.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <sheep/flonum.h>
+
+static int flonum_test(sheep_t sheep)
+{
+	return sheep_flonum(sheep) != 0.0;
+}
+
+static int flonum_equal(sheep_t a, sheep_t b)
+{
+	return sheep_flonum(a) == sheep_flonum(b);
+}
+
+static unsigned long flonum_hash(sheep_t sheep)
+{
+	double value = sheep_flonum(sheep);
+
+	/* -0.0 and 0.0 are equal */
+	if (value == 0.0)
+		value = 0.0;
+	return sheep_hash(&value, sizeof(double));
+}
+
+/* The shortest representation that reads back as the same value */
+static void flonum_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
+{
+	double value = sheep_flonum(sheep);
+	char buf[32];
+	int prec;
+
+	for (prec = 1; prec < 17; prec++) {
+		snprintf(buf, sizeof(buf), "%.*g", prec, value);
+		if (strtod(buf, NULL) == value)
+			break;
+	}
+	if (prec == 17)
+		snprintf(buf, sizeof(buf), "%.17g", value);
+
+	/* Keep integral values apart from integers */
+	if (!strpbrk(buf, ".en"))
+		strcat(buf, ".0");
+	sheep_strbuf_add(sb, buf);
+}
+
+const struct sheep_type sheep_flonum_type = {
+	.name = "flonum",
+	.compile = sheep_compile_constant,
+	.test = flonum_test,
+	.equal = flonum_equal,
+	.hash = flonum_hash,
+	.format = flonum_format,
+};
+
+/*
+ * Most doubles in practical use are encoded in the reference, the
+ * others are allocated.  The double is rotated left by one bit, to
+ * put the sign bit at the bottom, and its exponent is rebased so
+ * that the 8-bit exponents 1..255 cover the binary exponents
+ * -126..128.  This leaves 61 bits, which are shifted over the
+ * flonum tag.  Zero is encoded as is.
+ */
+sheep_t sheep_make_flonum(struct sheep_vm *vm, double value)
+{
+	struct sheep_flonum *flonum;
+	uint64_t bits, exponent;
+	sheep_t sheep;
+
+	memcpy(&bits, &value, sizeof(double));
+	bits = (bits << 1) | (bits >> 63);
+	exponent = bits >> 53;
+	if (sizeof(long) == sizeof(uint64_t) &&
+	    (bits <= 1 || (exponent > 896 && exponent < 896 + 256))) {
+		if (bits > 1)
+			bits -= SHEEP_FLONUM_BIAS;
+		return (sheep_t)(unsigned long)((bits << 3) |
+						SHEEP_FLONUM_TAG);
+	}
+
+	sheep = __sheep_make_object(vm, &sheep_flonum_type,
+				    sizeof(struct sheep_flonum));
+	flonum = sheep_inline_data(sheep);
+	flonum->value = value;
+	return sheep;
+}
+
+/*
+ * Only decimal literals with a fraction or an exponent are flonums,
+ * not names like inf or nan, and not literals out of range.
+ */
+int sheep_parse_flonum(struct sheep_vm *vm, const char *buf, sheep_t *sheepp)
+{
+	const char *p = buf;
+	int real = 0;
+	double value;
+	char *end;
+
+	if (*p == '-' || *p == '+')
+		p++;
+	if (*p == '.')
+		p++;
+	if (!isdigit((unsigned char)*p))
+		return -1;
+	for (p = buf; *p; p++) {
+		if (*p == '.' || *p == 'e' || *p == 'E')
+			real = 1;
+		else if (!isdigit((unsigned char)*p) && *p != '-' && *p != '+')
+			return -1;
+	}
+	if (!real)
+		return -1;
+
+	errno = 0;
+	value = strtod(buf, &end);
+	if (*end || (errno == ERANGE && isinf(value)))
+		return -1;
+	*sheepp = sheep_make_flonum(vm, value);
+	return 0;
+}
+
+double sheep_number_double(sheep_t sheep)
+{
+	if (sheep_is_fixnum(sheep))
+		return sheep_fixnum(sheep);
+	if (sheep_type(sheep) == &sheep_bignum_type)
+		return sheep_bignum_double(sheep);
+	return sheep_flonum(sheep);
+}
@@ -144,6 +144,8 @@ void sheep_foreign_save(struct sheep_vm *vm, unsigned long basep)
 
 		indirect->count = -indirect->count;
 		indirect->value.closed = vm->stack.items[index];
+		/* Closures do not know the age of their indirects */
+		sheep_remember(vm, indirect->value.closed);
 	}
 }
 
@@ -8,6 +8,7 @@
 #include <sheep/unpack.h>
 #include <sheep/bool.h>
 #include <sheep/code.h>
+#include <sheep/name.h>
 #include <sheep/util.h>
 #include <sheep/gc.h>
 #include <sheep/vm.h>
@@ -33,7 +34,6 @@ static void function_free(struct sheep_vm *vm, sheep_t sheep)
 	if (function->foreign)
 		free_freevar(function->foreign);
 	sheep_code_exit(&function->code);
-	sheep_free(function->name);
 	sheep_free(function);
 }
 
@@ -92,7 +92,6 @@ static void closure_free(struct sheep_vm *vm, sheep_t sheep)
 
 	closure = sheep_data(sheep);
 	sheep_foreign_release(vm, closure->foreign);
-	sheep_free(closure->name);
 	sheep_free(closure);
 }
 
@@ -110,7 +109,7 @@ sheep_t sheep_make_function(struct sheep_vm *vm, const char *name)
 
 	function = sheep_zalloc(sizeof(struct sheep_function));
 	if (name)
-		function->name = sheep_strdup(name);
+		function->name = sheep_intern(vm, name);
 	return sheep_make_object(vm, &sheep_function_type, function);
 }
 
@@ -121,11 +120,19 @@ sheep_t sheep_closure_function(struct sheep_vm *vm,
 
 	closure = sheep_malloc(sizeof(struct sheep_function));
 	*closure = *function;
-	if (function->name)
-		closure->name = sheep_strdup(function->name);
 	return sheep_make_object(vm, &sheep_closure_type, closure);
 }
 
+/* Finalize the code of @function and record its stack requirements */
+void sheep_function_finalize(struct sheep_function *function)
+{
+	sheep_code_finalize(&function->code);
+	if (sheep_code_analyze(&function->code, function->nr_locals,
+			       &function->max_stack))
+		sheep_bug("malformed code in function `%s'",
+			function->name ? function->name : "<anonymous>");
+}
+
 /* (disassemble function) */
 static sheep_t builtin_disassemble(struct sheep_vm *vm, unsigned int nr_args)
 {
@@ -140,8 +147,9 @@ static sheep_t builtin_disassemble(struct sheep_vm *vm, unsigned int nr_args)
 	else
 		nr_foreigns = 0;
 
-	printf("%u parameters, %u local slots, %u foreign references\n",
-		function->nr_parms, function->nr_locals, nr_foreigns);
+	printf("%u parameters, %u local slots, %u stack slots, "
+		"%u foreign references\n", function->nr_parms,
+		function->nr_locals, function->max_stack, nr_foreigns);
 
 	sheep_code_disassemble(&function->code);
 	return &sheep_nil;
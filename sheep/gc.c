@@ -3,68 +3,261 @@
  *
  * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
  */
+#include <sheep/number.h>
+#include <sheep/object.h>
+#include <sheep/string.h>
+#include <sheep/unpack.h>
 #include <sheep/vector.h>
 #include <sheep/types.h>
+#include <sheep/bool.h>
+#include <sheep/list.h>
+#include <sheep/read.h>
 #include <sheep/util.h>
 #include <sheep/vm.h>
 #include <sys/mman.h>
-#include <unistd.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <sheep/gc.h>
 
-#define PAGE_SIZE	sysconf(_SC_PAGE_SIZE)
-#define POOL_SIZE	(PAGE_SIZE / sizeof(struct sheep_object))
+/*
+ * Objects are allocated from per-size-class pools, so that small
+ * payloads (list cells, short strings, names) can live inline right
+ * behind the object header instead of in a separate allocation.
+ */
+static const unsigned int class_size[SHEEP_GC_CLASSES] = {
+	16, 32, 48, 64, 96, 128,
+};
+
+/* Class index by slot size in units of 16 bytes */
+static const unsigned char size_class[] = {
+	0, 0, 1, 2, 3, 4, 4, 5, 5,
+};
+
+/*
+ * The heap is split into two generations.  Objects can not be
+ * moved, because C code holds on to raw references, so promotion
+ * happens in place: mark bits are sticky between collections and
+ * a marked object is an old object.
+ *
+ * New objects are allocated from the nursery, the pools handed out
+ * to the allocator since the last collection.  A minor collection
+ * marks from the roots and the remembered set, does not descend into
+ * old objects, and only sweeps the nursery pools.  Whatever survives
+ * stays marked and is thereby promoted.  A major collection unmarks
+ * and sweeps the whole heap.
+ *
+ * A collection is due after nursery_pools pools have been handed
+ * out.  It is a major one once the heap has grown to the size that
+ * puts the live data of the last major collection at live_ratio
+ * percent of it, but never below min_heap_pools.
+ *
+ * Pools are mapped chunk_pools at a time, and unused pools are kept
+ * for reuse.  Only after a major collection are the unused pools
+ * beyond reserve_pools returned to the system, all in one go.
+ */
+#define DEFAULT_NURSERY_POOLS	64
+#define DEFAULT_MIN_HEAP_POOLS	128
+#define DEFAULT_LIVE_RATIO	50
+#define DEFAULT_CHUNK_POOLS	16
+#define DEFAULT_RESERVE_POOLS	64
+
+/*
+ * A pool is an aligned block of POOL_SIZE bytes that starts with
+ * this header, followed by the object slots.  The mark bits of the
+ * slots are kept in the header, so that the pool of an object, and
+ * thereby its mark bit, is found by masking the object address.
+ */
+#define POOL_SIZE		4096
+#define BITS_PER_LONG		(8 * sizeof(unsigned long))
+#define MARK_WORDS		(POOL_SIZE / 16 / BITS_PER_LONG)
 
 struct sheep_objects {
-	struct sheep_object *mem;
+	struct sheep_vm *vm;
 	struct sheep_object *free;
+	unsigned int size;
+	unsigned int nr_slots;
+	unsigned int nr_bumped;
 	unsigned int nr_used;
 	struct sheep_objects *next;
+	unsigned long marks[MARK_WORDS];
 };
 
-static struct sheep_objects *alloc_pool(void)
+static struct sheep_object *pool_slot(struct sheep_objects *pool,
+				      unsigned int index)
+{
+	return (struct sheep_object *)((char *)(pool + 1) + index * pool->size);
+}
+
+static struct sheep_objects *object_pool(sheep_t sheep)
+{
+	return (struct sheep_objects *)((unsigned long)sheep & ~(POOL_SIZE - 1));
+}
+
+static unsigned int object_index(struct sheep_objects *pool, sheep_t sheep)
+{
+	return ((char *)sheep - (char *)(pool + 1)) / pool->size;
+}
+
+/* The few statically allocated objects are not in any pool */
+static int heap_object(sheep_t sheep)
+{
+	if (sheep_is_immediate(sheep))
+		return 0;
+	return sheep != &sheep_nil && sheep != &sheep_true &&
+		sheep != &sheep_false && sheep != &sheep_eof;
+}
+
+/* Whether @sheep is marked, static objects always are */
+static int marked(sheep_t sheep)
 {
 	struct sheep_objects *pool;
-	unsigned int i;
+	unsigned int index;
+
+	if (!heap_object(sheep))
+		return 1;
+	pool = object_pool(sheep);
+	index = object_index(pool, sheep);
+	return !!(pool->marks[index / BITS_PER_LONG] &
+		(1UL << (index % BITS_PER_LONG)));
+}
 
-	pool = sheep_malloc(sizeof(struct sheep_objects));
-	pool->mem = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
-			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+/* Mark @sheep, returns whether it was marked already */
+static int test_and_mark(sheep_t sheep)
+{
+	struct sheep_objects *pool;
+	unsigned long *word, bit;
+	unsigned int index;
+
+	if (!heap_object(sheep))
+		return 1;
+	pool = object_pool(sheep);
+	index = object_index(pool, sheep);
+	word = &pool->marks[index / BITS_PER_LONG];
+	bit = 1UL << (index % BITS_PER_LONG);
+	if (*word & bit)
+		return 1;
+	*word |= bit;
+	return 0;
+}
 
-	pool->free = pool->mem;
-	for (i = 0; i < POOL_SIZE - 1; i++)
-		pool->mem[i].data = (unsigned long)&pool->mem[i + 1];
-	pool->nr_used = 0;
-	pool->next = NULL;
+/* Map a chunk of pools and put them on the unused list */
+static void map_chunk(struct sheep_vm *vm)
+{
+	unsigned int i, nr = vm->gc_config.chunk_pools;
+	char *chunk;
+
+	chunk = mmap(NULL, nr * POOL_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk == MAP_FAILED) {
+		fprintf(stderr, "sheep: out of memory\n");
+		abort();
+	}
+	for (i = 0; i < nr; i++) {
+		struct sheep_objects *pool;
+
+		pool = (struct sheep_objects *)(chunk + i * POOL_SIZE);
+		pool->next = vm->unused;
+		vm->unused = pool;
+	}
+	vm->nr_unused += nr;
+	vm->gc_stats.nr_mapped += nr;
+}
+
+static struct sheep_objects *alloc_pool(struct sheep_vm *vm,
+					unsigned int class)
+{
+	struct sheep_objects *pool;
+
+	if (!vm->unused)
+		map_chunk(vm);
+	pool = vm->unused;
+	vm->unused = pool->next;
+	vm->nr_unused--;
+
+	memset(pool, 0, sizeof(struct sheep_objects));
+	pool->vm = vm;
+	pool->size = class_size[class];
+	pool->nr_slots = (POOL_SIZE - sizeof(struct sheep_objects)) /
+		pool->size;
+	vm->nr_pools++;
 	return pool;
 }
 
-static void free_pool(struct sheep_objects *pool)
+static void free_pool(struct sheep_vm *vm, struct sheep_objects *pool)
 {
-	munmap(pool->mem, PAGE_SIZE);
-	sheep_free(pool);
+	pool->next = vm->unused;
+	vm->unused = pool;
+	vm->nr_unused++;
+	vm->nr_pools--;
 }
 
-static void unmark_pools(struct sheep_objects *pool)
+/* Return the unused pools beyond @keep to the system */
+static void trim_unused(struct sheep_vm *vm, unsigned int keep)
 {
-	while (pool) {
-		unsigned int i;
+	while (vm->nr_unused > keep) {
+		struct sheep_objects *pool = vm->unused;
 
-		for (i = 0; i < POOL_SIZE; i++) {
-			struct sheep_object *sheep = &pool->mem[i];
+		vm->unused = pool->next;
+		vm->nr_unused--;
+		munmap(pool, POOL_SIZE);
+		vm->gc_stats.nr_unmapped++;
+	}
+}
 
-			if (sheep->type)
-				sheep->data &= ~1;
-		}
+static void unmark_pools(struct sheep_objects *pool)
+{
+	while (pool) {
+		memset(pool->marks, 0, sizeof(pool->marks));
 		pool = pool->next;
 	}
 }
 
 static void unmark(struct sheep_vm *vm)
 {
-	unmark_pools(vm->parts);
-	unmark_pools(vm->fulls);
+	unsigned int class;
+
+	for (class = 0; class < SHEEP_GC_CLASSES; class++) {
+		unmark_pools(vm->nursery[class]);
+		unmark_pools(vm->parts[class]);
+		unmark_pools(vm->fulls[class]);
+	}
+}
+
+/*
+ * Marking does not recurse through the mark hooks: sheep_mark() only
+ * sets the mark bit and pushes the object onto the gray stack, and
+ * the collector then pops objects and runs their mark hooks until
+ * the stack is empty.  A list thus pushes its head and tail, and
+ * long tail chains are walked in a loop instead of on the C stack.
+ *
+ * The mark hooks do not get the vm passed, sheep_mark() finds the
+ * gray stack through the pool of the object instead.  The stack
+ * grows up to MARK_STACK_MAX entries.  Objects
+ * that do not fit are left marked but untraced, and the heap is
+ * rescanned for such objects once the stack has been drained.
+ */
+#define MARK_STACK_MAX		(1UL << 16)
+
+void sheep_mark(sheep_t sheep)
+{
+	struct sheep_vm *vm;
+
+	if (test_and_mark(sheep))
+		return;
+	if (!sheep_type(sheep)->mark)
+		return;
+	vm = object_pool(sheep)->vm;
+	if (vm->gray.nr_items == MARK_STACK_MAX) {
+		vm->gray_overflow = 1;
+		return;
+	}
+	sheep_vector_push(&vm->gray, sheep);
 }
 
 static void mark_protected(struct sheep_vector *protected)
@@ -75,107 +268,389 @@ static void mark_protected(struct sheep_vector *protected)
 		sheep_mark(protected->items[i]);
 }
 
-static unsigned int collect_pool(struct sheep_vm *vm,
-				 struct sheep_objects *pool)
+/*
+ * Remembered objects have been promoted by the write barrier, but
+ * their references have not been traced yet.
+ */
+static void mark_remembered(struct sheep_vector *remembered)
 {
-	unsigned int i, moved;
+	unsigned long i;
 
-	for (i = moved = 0; i < POOL_SIZE; i++) {
-		struct sheep_object *sheep = &pool->mem[i];
+	for (i = 0; i < remembered->nr_items; i++) {
+		sheep_t sheep = remembered->items[i];
 
-		if (sheep->data & 1)
-			continue;
+		if (sheep_type(sheep)->mark)
+			sheep_type(sheep)->mark(sheep);
+	}
+}
 
-		if (sheep->type->free)
-			sheep->type->free(vm, sheep);
+static void drain_gray(struct sheep_vm *vm)
+{
+	while (vm->gray.nr_items) {
+		sheep_t sheep = vm->gray.items[--vm->gray.nr_items];
 
-		sheep->data = (unsigned long)pool->free;
-		sheep->type = NULL;
-		pool->free = &pool->mem[i];
-		pool->nr_used--;
-		moved++;
+		sheep_type(sheep)->mark(sheep);
 	}
-	return moved;
 }
 
-static void collect(struct sheep_vm *vm)
+static void rescan_pools(struct sheep_vm *vm, struct sheep_objects *pool)
 {
-	struct sheep_objects *pool, *next,
-		*cache_part = NULL, *last_full = NULL;
+	while (pool) {
+		unsigned int i;
 
-	if (vm->gc_disabled)
-		goto alloc;
+		for (i = 0; i < MARK_WORDS; i++) {
+			unsigned long word = pool->marks[i];
+
+			while (word) {
+				struct sheep_object *sheep;
+				unsigned int bit;
+
+				bit = __builtin_ctzl(word);
+				word &= word - 1;
+				sheep = pool_slot(pool, i * BITS_PER_LONG + bit);
+				if (sheep->type->mark) {
+					sheep->type->mark(sheep);
+					drain_gray(vm);
+				}
+			}
+		}
+		pool = pool->next;
+	}
+}
 
-	unmark(vm);
-	sheep_vm_mark(vm);
-	mark_protected(&vm->protected);
+/*
+ * Trace everything reachable from the objects marked so far.  If the
+ * gray stack overflowed, some marked objects were not traced, so all
+ * marked objects on the heap have their references marked again.
+ */
+static void trace(struct sheep_vm *vm)
+{
+	drain_gray(vm);
+	while (vm->gray_overflow) {
+		unsigned int class;
+
+		vm->gray_overflow = 0;
+		for (class = 0; class < SHEEP_GC_CLASSES; class++) {
+			rescan_pools(vm, vm->nursery[class]);
+			rescan_pools(vm, vm->parts[class]);
+			rescan_pools(vm, vm->fulls[class]);
+		}
+	}
+}
+
+static struct sheep_gc_typestats *type_stats(struct sheep_vm *vm,
+					     const struct sheep_type *type)
+{
+	struct sheep_gc_typestats *stats;
+	unsigned long i;
 
-	for (pool = vm->fulls; pool; pool = next) {
-		unsigned int moved;
+	for (i = 0; i < vm->gc_stats.types.nr_items; i++) {
+		stats = vm->gc_stats.types.items[i];
+		if (stats->type == type)
+			return stats;
+	}
+	stats = sheep_zalloc(sizeof(struct sheep_gc_typestats));
+	stats->type = type;
+	sheep_vector_push(&vm->gc_stats.types, stats);
+	return stats;
+}
 
-		moved = collect_pool(vm, pool);
-		next = pool->next;
+/* Release the unmarked objects in @pool, visiting only unmarked slots */
+static void collect_pool(struct sheep_vm *vm, struct sheep_objects *pool)
+{
+	struct sheep_gc_typestats *stats = NULL;
+	unsigned int i;
+
+	for (i = 0; i * BITS_PER_LONG < pool->nr_bumped; i++) {
+		unsigned long word = ~pool->marks[i];
+		unsigned int left = pool->nr_bumped - i * BITS_PER_LONG;
+
+		if (left < BITS_PER_LONG)
+			word &= (1UL << left) - 1;
 
-		if (!moved) {
-			last_full = pool;
-			continue;
+		while (word) {
+			struct sheep_object *sheep;
+			unsigned int bit;
+
+			bit = __builtin_ctzl(word);
+			word &= word - 1;
+			sheep = pool_slot(pool, i * BITS_PER_LONG + bit);
+			if (!sheep->type)
+				continue;
+
+			if (sheep->type->free)
+				sheep->type->free(vm, sheep);
+
+			if (!stats || stats->type != sheep->type)
+				stats = type_stats(vm, sheep->type);
+			stats->nr_freed++;
+			vm->gc_stats.nr_freed++;
+
+			sheep->data = (unsigned long)pool->free;
+			sheep->type = NULL;
+			pool->free = sheep;
+			pool->nr_used--;
 		}
+	}
+
+	/* Empty pools go back to bump allocation */
+	if (!pool->nr_used) {
+		pool->free = NULL;
+		pool->nr_bumped = 0;
+	}
+}
+
+/*
+ * Sweep the pools on @pools and sort them onto the full and partial
+ * lists of @class.  Empty pools beyond the first are released if
+ * @release is set.
+ */
+static void collect_pools(struct sheep_vm *vm,
+			  unsigned int class,
+			  struct sheep_objects *pools,
+			  int release)
+{
+	struct sheep_objects *pool, *next, *empty = NULL;
 
-		if (last_full)
-			last_full->next = pool->next;
+	for (pool = pools; pool; pool = next) {
+		next = pool->next;
+		collect_pool(vm, pool);
+
+		if (pool->nr_used == pool->nr_slots) {
+			pool->next = vm->fulls[class];
+			vm->fulls[class] = pool;
+		} else if (pool->nr_used || !release) {
+			pool->next = vm->parts[class];
+			vm->parts[class] = pool;
+		} else if (!empty)
+			empty = pool;
 		else
-			vm->fulls = pool->next;
+			free_pool(vm, pool);
+	}
 
-		if (moved < POOL_SIZE || !cache_part) {
-			pool->next = vm->parts;
-			vm->parts = cache_part = pool;
-		} else
-			free_pool(pool);
+	/* Keep one empty pool around if nothing else has room */
+	if (empty) {
+		if (vm->parts[class])
+			free_pool(vm, empty);
+		else {
+			empty->next = NULL;
+			vm->parts[class] = empty;
+		}
 	}
+}
+
+static struct sheep_objects *splice(struct sheep_objects *a,
+				    struct sheep_objects *b)
+{
+	struct sheep_objects *pool;
 
-alloc:
-	if (!vm->parts)
-		vm->parts = alloc_pool();
+	if (!a)
+		return b;
+	for (pool = a; pool->next; pool = pool->next)
+		;
+	pool->next = b;
+	return a;
 }
 
-static sheep_t alloc(struct sheep_vm *vm)
+/*
+ * Sweeping is lazy: a collection only marks and then queues the
+ * pools it has to sweep.  The allocator sweeps queued pools one at
+ * a time as it needs free slots, and the next collection sweeps
+ * what is left before it starts marking.
+ */
+static void finish_sweep(struct sheep_vm *vm)
 {
-	struct sheep_object *sheep;
+	unsigned int class;
 
-	sheep = vm->parts->free;
-	vm->parts->nr_used++;
+	for (class = 0; class < SHEEP_GC_CLASSES; class++) {
+		struct sheep_objects *pools = vm->unswept[class];
 
-	if (vm->parts->nr_used < POOL_SIZE)
-		vm->parts->free = (struct sheep_object *)sheep->data;
-	else {
-		struct sheep_objects *pool;
+		vm->unswept[class] = NULL;
+		collect_pools(vm, class, pools, vm->sweep_release);
+	}
+	if (vm->sweep_release)
+		trim_unused(vm, vm->gc_config.reserve_pools);
+}
 
-		pool = vm->parts;
-		vm->parts = vm->parts->next;
+/* Sweep queued pools of @class until one with free slots turns up */
+static struct sheep_objects *lazy_sweep(struct sheep_vm *vm,
+					unsigned int class)
+{
+	struct sheep_objects *pool;
 
-		pool->next = vm->fulls;
-		vm->fulls = pool;
+	while ((pool = vm->unswept[class])) {
+		vm->unswept[class] = pool->next;
+		collect_pool(vm, pool);
+		if (pool->nr_used < pool->nr_slots)
+			return pool;
+		pool->next = vm->fulls[class];
+		vm->fulls[class] = pool;
 	}
-	return sheep;
+	return NULL;
+}
+
+static int pool_marked(struct sheep_objects *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < MARK_WORDS; i++)
+		if (pool->marks[i])
+			return 1;
+	return 0;
+}
+
+static void collect_minor(struct sheep_vm *vm)
+{
+	unsigned int class;
+
+	sheep_vm_mark(vm);
+	mark_protected(&vm->protected);
+	mark_remembered(&vm->remembered);
+	trace(vm);
+
+	for (class = 0; class < SHEEP_GC_CLASSES; class++) {
+		vm->unswept[class] = vm->nursery[class];
+		vm->nursery[class] = NULL;
+	}
+	vm->sweep_release = 0;
+}
+
+static void collect_major(struct sheep_vm *vm)
+{
+	struct sheep_gc_config *config = &vm->gc_config;
+	unsigned int class, nr_live = 0;
+
+	unmark(vm);
+	sheep_vm_mark(vm);
+	mark_protected(&vm->protected);
+	trace(vm);
+
+	for (class = 0; class < SHEEP_GC_CLASSES; class++) {
+		struct sheep_objects *pools, *pool;
+
+		/* Partial pools go first, so their free slots are reused first */
+		pools = splice(vm->parts[class], vm->fulls[class]);
+		pools = splice(vm->nursery[class], pools);
+		vm->nursery[class] = vm->parts[class] = vm->fulls[class] = NULL;
+		vm->unswept[class] = pools;
+
+		for (pool = pools; pool; pool = pool->next)
+			nr_live += pool_marked(pool);
+	}
+	vm->sweep_release = 1;
+
+	vm->major_pools = nr_live * 100 / config->live_ratio;
+	if (vm->major_pools < config->min_heap_pools)
+		vm->major_pools = config->min_heap_pools;
+}
+
+static unsigned long clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
 }
 
-struct sheep_object *sheep_gc_alloc(struct sheep_vm *vm)
+static void collect(struct sheep_vm *vm)
 {
-	if (!vm->parts)
+	struct sheep_gc_stats *stats = &vm->gc_stats;
+	unsigned long start, pause;
+	int major;
+
+	start = clock_ns();
+	finish_sweep(vm);
+
+	major = vm->nr_pools >= vm->major_pools;
+	if (major) {
+		collect_major(vm);
+		stats->nr_major++;
+	} else {
+		collect_minor(vm);
+		stats->nr_minor++;
+	}
+
+	vm->remembered.nr_items = 0;
+	vm->nr_nursery = 0;
+
+	pause = clock_ns() - start;
+	stats->pause_total += pause;
+	if (pause > stats->pause_max)
+		stats->pause_max = pause;
+
+	if (vm->gc_trace)
+		fprintf(stderr, "gc: %s #%lu: %u pools, %lu allocated, "
+			"%lu freed, %lu.%03lums\n",
+			major ? "major" : "minor",
+			major ? stats->nr_major : stats->nr_minor,
+			vm->nr_pools, stats->nr_allocated, stats->nr_freed,
+			pause / 1000000, pause / 1000 % 1000);
+}
+
+/* Find a pool with free slots for @class and add it to the nursery */
+static struct sheep_objects *refill(struct sheep_vm *vm, unsigned int class)
+{
+	struct sheep_objects *pool;
+
+	if (vm->nr_nursery >= vm->gc_config.nursery_pools && !vm->gc_disabled)
 		collect(vm);
 
-	return alloc(vm);
+	pool = lazy_sweep(vm, class);
+	if (!pool) {
+		pool = vm->parts[class];
+		if (pool)
+			vm->parts[class] = pool->next;
+		else
+			pool = alloc_pool(vm, class);
+	}
+
+	pool->next = vm->nursery[class];
+	vm->nursery[class] = pool;
+	vm->nr_nursery++;
+	return pool;
 }
 
-void sheep_mark(sheep_t sheep)
+struct sheep_object *__sheep_gc_alloc(struct sheep_vm *vm, size_t size)
 {
-	if (sheep_is_fixnum(sheep))
-		return;
-	if (sheep->data & 1)
+	struct sheep_objects *pool;
+	struct sheep_object *sheep;
+	unsigned int class;
+
+	size += sizeof(struct sheep_object);
+	sheep_bug_on(size > class_size[SHEEP_GC_CLASSES - 1]);
+	class = size_class[(size + 15) >> 4];
+
+	pool = vm->nursery[class];
+	if (!pool || pool->nr_used == pool->nr_slots)
+		pool = refill(vm, class);
+
+	if (pool->free) {
+		sheep = pool->free;
+		pool->free = (struct sheep_object *)sheep->data;
+	} else
+		sheep = pool_slot(pool, pool->nr_bumped++);
+	pool->nr_used++;
+	vm->gc_stats.nr_allocated++;
+
+	return sheep;
+}
+
+/*
+ * Promote @sheep, and have its references traced by the next
+ * collection.  Remembering promotes in order to keep every object in
+ * the set only once.
+ */
+void sheep_remember(struct sheep_vm *vm, sheep_t sheep)
+{
+	if (test_and_mark(sheep))
 		return;
-	sheep->data |= 1;
-	if (sheep_type(sheep)->mark)
-		sheep_type(sheep)->mark(sheep);
+	sheep_vector_push(&vm->remembered, sheep);
+}
+
+void sheep_write_barrier(struct sheep_vm *vm, sheep_t container, sheep_t value)
+{
+	if (marked(container))
+		sheep_remember(vm, value);
 }
 
 void sheep_protect(struct sheep_vm *vm, sheep_t sheep)
@@ -195,29 +670,225 @@ static void drain_pool(struct sheep_vm *vm, struct sheep_objects *pool)
 {
 	unsigned int i;
 
-	for (i = 0; i < POOL_SIZE; i++) {
-		struct sheep_object *sheep = &pool->mem[i];
+	for (i = 0; i < pool->nr_bumped; i++) {
+		struct sheep_object *sheep = pool_slot(pool, i);
 
 		if (sheep->type && sheep->type->free)
 			sheep->type->free(vm, sheep);
 	}
 }
 
-void sheep_gc_exit(struct sheep_vm *vm)
+static void drain_pools(struct sheep_vm *vm, struct sheep_objects *pool)
 {
 	struct sheep_objects *next;
 
+	for (; pool; pool = next) {
+		next = pool->next;
+		drain_pool(vm, pool);
+		free_pool(vm, pool);
+	}
+}
+
+void sheep_gc_init(struct sheep_vm *vm)
+{
+	struct sheep_gc_config *config = &vm->gc_config;
+
+	config->nursery_pools = DEFAULT_NURSERY_POOLS;
+	config->min_heap_pools = DEFAULT_MIN_HEAP_POOLS;
+	config->live_ratio = DEFAULT_LIVE_RATIO;
+	config->chunk_pools = DEFAULT_CHUNK_POOLS;
+	config->reserve_pools = DEFAULT_RESERVE_POOLS;
+	vm->major_pools = config->min_heap_pools;
+	vm->gc_trace = getenv("SHEEP_GC_TRACE") != NULL;
+}
+
+static const struct gc_setting {
+	const char *name;
+	size_t offset;
+	unsigned int min, max;
+} gc_settings[] = {
+	{ "nursery", offsetof(struct sheep_gc_config, nursery_pools),
+	  1, UINT_MAX },
+	{ "min-heap", offsetof(struct sheep_gc_config, min_heap_pools),
+	  0, UINT_MAX },
+	{ "live-ratio", offsetof(struct sheep_gc_config, live_ratio),
+	  1, 100 },
+	{ "chunk", offsetof(struct sheep_gc_config, chunk_pools),
+	  1, 1024 },
+	{ "reserve", offsetof(struct sheep_gc_config, reserve_pools),
+	  0, UINT_MAX },
+	{ NULL },
+};
+
+/* (gc-config setting &optional value) */
+static sheep_t builtin_gc_config(struct sheep_vm *vm, unsigned int nr_args)
+{
+	const struct gc_setting *setting;
+	unsigned int *knob, old;
+	const char *name;
+	long value = 0;
+	sheep_t name_;
+
+	if (nr_args == 2) {
+		if (sheep_unpack_stack(vm, nr_args, "sN", &name_, &value))
+			return NULL;
+	} else if (sheep_unpack_stack(vm, nr_args, "s", &name_))
+		return NULL;
+
+	name = sheep_rawstring(name_);
+	for (setting = gc_settings; setting->name; setting++)
+		if (!strcmp(setting->name, name))
+			break;
+	if (!setting->name) {
+		sheep_error(vm, "unknown gc setting `%s'", name);
+		return NULL;
+	}
+
+	knob = (unsigned int *)((char *)&vm->gc_config + setting->offset);
+	old = *knob;
+	if (nr_args == 2) {
+		if (value < setting->min || value > setting->max) {
+			sheep_error(vm, "%s must be within [%u, %u]",
+				name, setting->min, setting->max);
+			return NULL;
+		}
+		*knob = value;
+	}
+	return sheep_make_number(vm, old);
+}
+
+/* Count the objects of each type that are on the heap */
+static void count_pools(struct sheep_vm *vm, struct sheep_objects *pool)
+{
+	for (; pool; pool = pool->next) {
+		struct sheep_gc_typestats *stats = NULL;
+		unsigned int i;
+
+		for (i = 0; i < pool->nr_bumped; i++) {
+			struct sheep_object *sheep = pool_slot(pool, i);
+
+			if (!sheep->type)
+				continue;
+			if (!stats || stats->type != sheep->type)
+				stats = type_stats(vm, sheep->type);
+			stats->nr_present++;
+		}
+	}
+}
+
+static sheep_t stats_entry(struct sheep_vm *vm,
+			   const char *name,
+			   unsigned int nr,
+			   ...)
+{
+	sheep_t entry, pos;
+	va_list ap;
+
+	entry = pos = sheep_make_cons(vm, NULL, NULL);
+	sheep_protect(vm, entry);
+
+	pos = sheep_list_append(vm, pos, sheep_make_string(vm, name));
+	va_start(ap, nr);
+	while (nr--) {
+		sheep_t value;
+
+		value = sheep_make_number(vm, va_arg(ap, unsigned long));
+		pos = sheep_list_append(vm, pos, value);
+	}
+	va_end(ap);
+
+	sheep_unprotect(vm, entry);
+	return entry;
+}
+
+/*
+ * (gc-stats)
+ *
+ * Returns a list of (name value) entries, with times in microseconds,
+ * followed by a (type allocated freed) entry for every object type.
+ */
+static sheep_t builtin_gc_stats(struct sheep_vm *vm, unsigned int nr_args)
+{
+	struct sheep_gc_stats *stats = &vm->gc_stats;
+	unsigned int class;
+	sheep_t list, pos;
+	unsigned long i;
+
+	if (sheep_unpack_stack(vm, nr_args, ""))
+		return NULL;
+
+	for (i = 0; i < stats->types.nr_items; i++) {
+		struct sheep_gc_typestats *type = stats->types.items[i];
+
+		type->nr_present = 0;
+	}
+	for (class = 0; class < SHEEP_GC_CLASSES; class++) {
+		count_pools(vm, vm->nursery[class]);
+		count_pools(vm, vm->parts[class]);
+		count_pools(vm, vm->fulls[class]);
+		count_pools(vm, vm->unswept[class]);
+	}
+
+	list = pos = sheep_make_cons(vm, NULL, NULL);
+	sheep_protect(vm, list);
+
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "minor", 1, stats->nr_minor));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "major", 1, stats->nr_major));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "allocated", 1, stats->nr_allocated));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "freed", 1, stats->nr_freed));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "pools", 1, (unsigned long)vm->nr_pools));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "pools-mapped", 1, stats->nr_mapped));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "pools-unmapped", 1, stats->nr_unmapped));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "pause-total", 1,
+				stats->pause_total / 1000));
+	pos = sheep_list_append(vm, pos,
+			stats_entry(vm, "pause-max", 1,
+				stats->pause_max / 1000));
+
+	for (i = 0; i < stats->types.nr_items; i++) {
+		struct sheep_gc_typestats *type = stats->types.items[i];
+		sheep_t entry;
+
+		entry = stats_entry(vm, type->type->name, 2,
+				type->nr_freed + type->nr_present,
+				type->nr_freed);
+		pos = sheep_list_append(vm, pos, entry);
+	}
+
+	sheep_unprotect(vm, list);
+	return list;
+}
+
+void sheep_gc_builtins(struct sheep_vm *vm)
+{
+	sheep_vm_function(vm, "gc-config", builtin_gc_config);
+	sheep_vm_function(vm, "gc-stats", builtin_gc_stats);
+}
+
+void sheep_gc_exit(struct sheep_vm *vm)
+{
+	unsigned int class;
+	unsigned long i;
+
 	sheep_free(vm->protected.items);
-	while (vm->parts) {
-		next = vm->parts->next;
-		drain_pool(vm, vm->parts);
-		free_pool(vm->parts);
-		vm->parts = next;
-	}
-	while (vm->fulls) {
-		next = vm->fulls->next;
-		drain_pool(vm, vm->fulls);
-		free_pool(vm->fulls);
-		vm->fulls = next;
+	sheep_free(vm->remembered.items);
+	sheep_free(vm->gray.items);
+	for (class = 0; class < SHEEP_GC_CLASSES; class++) {
+		drain_pools(vm, vm->nursery[class]);
+		drain_pools(vm, vm->parts[class]);
+		drain_pools(vm, vm->fulls[class]);
+		drain_pools(vm, vm->unswept[class]);
 	}
+	trim_unused(vm, 0);
+	for (i = 0; i < vm->gc_stats.types.nr_items; i++)
+		sheep_free(vm->gc_stats.types.items[i]);
+	sheep_free(vm->gc_stats.types.items);
 }
@@ -34,11 +34,6 @@ static void list_mark(sheep_t sheep)
 		sheep_mark(list->tail);
 }
 
-static void list_free(struct sheep_vm *vm, sheep_t sheep)
-{
-	sheep_free(sheep_list(sheep));
-}
-
 static int list_test(sheep_t sheep)
 {
 	return !!sheep_list(sheep)->head;
@@ -91,14 +86,8 @@ static sheep_t do_list_concat(struct sheep_vm *vm, sheep_t base, sheep_t tail)
 {
 	struct sheep_list *pos;
 
-	for (pos = sheep_list(tail); pos->head; pos = sheep_list(pos->tail)) {
-		struct sheep_list *node;
-
-		node = sheep_list(base);
-		node->head = pos->head;
-		node->tail = sheep_make_cons(vm, NULL, NULL);
-		base = node->tail;
-	}
+	for (pos = sheep_list(tail); pos->head; pos = sheep_list(pos->tail))
+		base = sheep_list_append(vm, base, pos->head);
 	return base;
 }
 
@@ -179,24 +168,20 @@ static sheep_t list_slice(struct sheep_vm *vm,
 			  size_t from,
 			  size_t to)
 {
-	struct sheep_list *list, *pos;
-	sheep_t new, result = NULL;
+	sheep_t new, pos, result = NULL;
+	struct sheep_list *list;
 	size_t index = 0;
 
 	sheep_protect(vm, sheep);
 
-	new = sheep_make_cons(vm, NULL, NULL);
+	new = pos = sheep_make_cons(vm, NULL, NULL);
 	sheep_protect(vm, new);
 
 	list = sheep_list(sheep);
-	pos = sheep_list(new);
 
 	while (index < to && list->head) {
-		if (index >= from) {
-			pos->head = list->head;
-			pos->tail = sheep_make_cons(vm, NULL, NULL);
-			pos = sheep_list(pos->tail);
-		}
+		if (index >= from)
+			pos = sheep_list_append(vm, pos, list->head);
 		list = sheep_list(list->tail);
 		index++;
 
@@ -240,7 +225,6 @@ static const struct sheep_sequence list_sequence = {
 const struct sheep_type sheep_list_type = {
 	.name = "list",
 	.mark = list_mark,
-	.free = list_free,
 	.compile = sheep_compile_list,
 	.test = list_test,
 	.equal = list_equal,
@@ -251,52 +235,49 @@ const struct sheep_type sheep_list_type = {
 sheep_t sheep_make_cons(struct sheep_vm *vm, sheep_t head, sheep_t tail)
 {
 	struct sheep_list *list;
+	sheep_t sheep;
 
-	list = sheep_malloc(sizeof(struct sheep_list));
+	sheep = __sheep_make_object(vm, &sheep_list_type,
+				sizeof(struct sheep_list));
+	list = sheep_list(sheep);
 	list->head = head;
 	list->tail = tail;
-	return sheep_make_object(vm, &sheep_list_type, list);
+	return sheep;
 }
 
 sheep_t sheep_make_list(struct sheep_vm *vm, unsigned int nr, ...)
 {
-	struct sheep_list *p;
-	sheep_t list;
+	sheep_t list, pos;
 	va_list ap;
 
-	list = sheep_make_cons(vm, NULL, NULL);
+	list = pos = sheep_make_cons(vm, NULL, NULL);
 	sheep_protect(vm, list);
 
-	p = sheep_list(list);
-
 	va_start(ap, nr);
-	while (nr--) {
-		p->head = va_arg(ap, sheep_t);
-		p->tail = sheep_make_cons(vm, NULL, NULL);
-		p = sheep_list(p->tail);
-	}
+	while (nr--)
+		pos = sheep_list_append(vm, pos, va_arg(ap, sheep_t));
 	va_end(ap);
 
 	sheep_unprotect(vm, list);
 	return list;
 }
 
-int sheep_list_search(struct sheep_list *list, sheep_t object, size_t *offset)
+/*
+ * Fill in the empty last cell @pos of a list under construction with
+ * @item and return the new empty last cell.
+ */
+sheep_t sheep_list_append(struct sheep_vm *vm, sheep_t pos, sheep_t item)
 {
-	while (list->head) {
-		if (list->head == object)
-			return 1;
-		(*offset)++;
-		if (sheep_type(list->head) == &sheep_list_type) {
-			struct sheep_list *sublist;
-
-			sublist = sheep_list(list->head);
-			if (sheep_list_search(sublist, object, offset))
-				return 1;
-		}
-		list = sheep_list(list->tail);
-	}
-	return 0;
+	sheep_t tail;
+
+	sheep_list(pos)->head = item;
+	sheep_write_barrier(vm, pos, item);
+
+	tail = sheep_make_cons(vm, NULL, NULL);
+	sheep_list(pos)->tail = tail;
+	sheep_write_barrier(vm, pos, tail);
+
+	return tail;
 }
 
 /* (cons item list) */
@@ -401,19 +382,18 @@ static sheep_t builtin_find(struct sheep_vm *vm, unsigned int nr_args)
 /* (filter predicate list) */
 static sheep_t builtin_filter(struct sheep_vm *vm, unsigned int nr_args)
 {
-	sheep_t filter, old_, new_, result = NULL;
-	struct sheep_list *old, *new;
+	sheep_t filter, old_, new_, pos, result = NULL;
+	struct sheep_list *old;
 
 	if (sheep_unpack_stack(vm, nr_args, "cl", &filter, &old_))
 		return NULL;
 	sheep_protect(vm, filter);
 	sheep_protect(vm, old_);
 
-	new_ = sheep_make_cons(vm, NULL, NULL);
+	new_ = pos = sheep_make_cons(vm, NULL, NULL);
 	sheep_protect(vm, new_);
 
 	old = sheep_list(old_);
-	new = sheep_list(new_);
 
 	while (old->head) {
 		sheep_t value;
@@ -421,11 +401,8 @@ static sheep_t builtin_filter(struct sheep_vm *vm, unsigned int nr_args)
 		value = sheep_call(vm, filter, 1, old->head);
 		if (!value)
 			goto out;
-		if (sheep_test(value)) {
-			new->head = old->head;
-			new->tail = sheep_make_cons(vm, NULL, NULL);
-			new = sheep_list(new->tail);
-		}
+		if (sheep_test(value))
+			pos = sheep_list_append(vm, pos, old->head);
 		old = sheep_list(old->tail);
 	}
 	result = new_;
@@ -452,26 +429,26 @@ static sheep_t builtin_apply(struct sheep_vm *vm, unsigned int nr_args)
 /* (map function list) */
 static sheep_t builtin_map(struct sheep_vm *vm, unsigned int nr_args)
 {
-	sheep_t mapper, old_, new_, result = NULL;
-	struct sheep_list *old, *new;
+	sheep_t mapper, old_, new_, pos, result = NULL;
+	struct sheep_list *old;
 
 	if (sheep_unpack_stack(vm, nr_args, "cl", &mapper, &old_))
 		return NULL;
 	sheep_protect(vm, mapper);
 	sheep_protect(vm, old_);
 
-	new_ = sheep_make_cons(vm, NULL, NULL);
+	new_ = pos = sheep_make_cons(vm, NULL, NULL);
 	sheep_protect(vm, new_);
 
 	old = sheep_list(old_);
-	new = sheep_list(new_);
 
 	while (old->head) {
-		new->head = sheep_call(vm, mapper, 1, old->head);
-		if (!new->head)
+		sheep_t value;
+
+		value = sheep_call(vm, mapper, 1, old->head);
+		if (!value)
 			goto out;
-		new->tail = sheep_make_cons(vm, NULL, NULL);
-		new = sheep_list(new->tail);
+		pos = sheep_list_append(vm, pos, value);
 		old = sheep_list(old->tail);
 	}
 	result = new_;
@@ -4,93 +4,145 @@
  * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
  */
 #include <sheep/util.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <sheep/map.h>
 
-struct sheep_map_entry {
-	const char *name;
-	void *value;
-	struct sheep_map_entry *next;
-};
+/*
+ * The map is an open-addressing table with linear probing.  It
+ * starts out with the entries embedded in the map and is doubled
+ * when it gets three quarters full.  Deletion shifts the following
+ * entries of the probe sequence back, so no tombstones are needed.
+ */
 
-static int hash(const char *name)
+static struct sheep_map_entry *entries(struct sheep_map *map)
 {
-	int key = 0;
+	if (map->size)
+		return map->entries;
+	return map->inline_entries;
+}
 
-	while (*name)
-		key += (key << 5) + *name++;
-	return key < 0 ? -key : key;
+static unsigned int capacity(struct sheep_map *map)
+{
+	if (map->size)
+		return map->size;
+	return SHEEP_MAP_INLINE;
 }
 
-static struct sheep_map_entry **find(struct sheep_map *map,
-				     const char *name,
-				     int *create)
+/* Keys are interned, their address is their identity */
+static unsigned int hash(const char *name)
 {
-	struct sheep_map_entry **pentry, *entry;
-	int index;
-
-	index = hash(name) % SHEEP_MAP_SIZE;
-	pentry = &map->entries[index];
-	while (*pentry) {
-		if (!strcmp((*pentry)->name, name))
-			return pentry;
-		pentry = &(*pentry)->next;
-	}
-	if (!create)
-		return NULL;
-	entry = sheep_malloc(sizeof(*entry));
-	entry->name = sheep_strdup(name);
-	entry->next = map->entries[index];
-	map->entries[index] = entry;
-	*create = 1;
-	return &map->entries[index];
+	uint64_t key = (uintptr_t)name;
+
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static struct sheep_map_entry *find(struct sheep_map_entry *table,
+				    unsigned int size,
+				    const char *name)
+{
+	unsigned int index, mask = size - 1;
+
+	index = hash(name) & mask;
+	while (table[index].name && table[index].name != name)
+		index = (index + 1) & mask;
+	return &table[index];
+}
+
+static void grow(struct sheep_map *map)
+{
+	struct sheep_map_entry *old, *table;
+	unsigned int i, size, old_size;
+
+	old = entries(map);
+	old_size = capacity(map);
+	size = old_size * 2;
+	table = sheep_zalloc(sizeof(struct sheep_map_entry) * size);
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].name)
+			*find(table, size, old[i].name) = old[i];
+
+	if (map->size)
+		sheep_free(map->entries);
+	map->entries = table;
+	map->size = size;
 }
 
 int sheep_map_set(struct sheep_map *map, const char *name, void *value)
 {
-	struct sheep_map_entry **pentry;
-	int create = 0;
+	struct sheep_map_entry *entry;
 
-	pentry = find(map, name, &create);
-	(*pentry)->value = value;
-	return !create;
+	entry = find(entries(map), capacity(map), name);
+	if (entry->name) {
+		entry->value = value;
+		return 1;
+	}
+	if ((map->nr_entries + 1) * 4 > capacity(map) * 3) {
+		grow(map);
+		entry = find(entries(map), capacity(map), name);
+	}
+	entry->name = name;
+	entry->value = value;
+	map->nr_entries++;
+	return 0;
 }
 
 int sheep_map_get(struct sheep_map *map, const char *name, void **valuep)
 {
-	struct sheep_map_entry **pentry;
+	struct sheep_map_entry *entry;
 
-	pentry = find(map, name, NULL);
-	if (!pentry)
+	entry = find(entries(map), capacity(map), name);
+	if (!entry->name)
 		return -1;
-	*valuep = (*pentry)->value;
+	*valuep = entry->value;
 	return 0;
 }
 
 int sheep_map_del(struct sheep_map *map, const char *name)
 {
-	struct sheep_map_entry **pentry, *entry;
+	struct sheep_map_entry *table = entries(map);
+	unsigned int hole, index, home, mask;
 
-	pentry = find(map, name, NULL);
-	if (!pentry)
+	mask = capacity(map) - 1;
+	hole = find(table, capacity(map), name) - table;
+	if (!table[hole].name)
 		return -1;
-	entry = *pentry;
-	*pentry = entry->next;
-	sheep_free(entry->name);
-	sheep_free(entry);
+
+	/*
+	 * Move back every following entry whose home slot is not
+	 * cyclically between the hole and the entry itself.
+	 */
+	for (index = (hole + 1) & mask; table[index].name;
+	     index = (index + 1) & mask) {
+		home = hash(table[index].name) & mask;
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			table[hole] = table[index];
+			hole = index;
+		}
+	}
+	table[hole].name = NULL;
+	map->nr_entries--;
 	return 0;
 }
 
+/* Call @fn with every key and value in @map, in no particular order */
+void sheep_map_each(struct sheep_map *map,
+		    void (*fn)(const char *, void *, void *),
+		    void *data)
+{
+	struct sheep_map_entry *table = entries(map);
+	unsigned int i, size = capacity(map);
+
+	for (i = 0; i < size; i++)
+		if (table[i].name)
+			fn(table[i].name, table[i].value, data);
+}
+
 void sheep_map_drain(struct sheep_map *map)
 {
-	struct sheep_map_entry *entry, *next;
-	unsigned int i;
-
-	for (i = 0; i < SHEEP_MAP_SIZE; i++)
-		for (entry = map->entries[i]; entry; entry = next) {
-			next = entry->next;
-			sheep_free(entry->name);
-			sheep_free(entry);
-		}
+	if (map->size)
+		sheep_free(map->entries);
+	memset(map, 0, sizeof(struct sheep_map));
 }
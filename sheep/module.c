@@ -3,17 +3,25 @@
  *
  * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
  */
+#include <sheep/bytecode.h>
 #include <sheep/compile.h>
 #include <sheep/config.h>
 #include <sheep/object.h>
 #include <sheep/string.h>
 #include <sheep/vector.h>
+#include <sheep/array.h>
+#include <sheep/code.h>
 #include <sheep/eval.h>
+#include <sheep/name.h>
 #include <sheep/read.h>
 #include <sheep/util.h>
 #include <sheep/map.h>
+#include <sheep/gc.h>
 #include <sheep/vm.h>
 #include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 #include <dlfcn.h>
 #include <stdio.h>
 
@@ -23,6 +31,7 @@ static void free_module(struct sheep_module *mod)
 {
 	sheep_free(mod->name);
 	sheep_map_drain(&mod->env);
+	sheep_free(mod->globals.items);
 #if 0
 	/*
 	 * XXX: dlclose() is not a good idea when there are still
@@ -53,7 +62,6 @@ const struct sheep_type sheep_module_type = {
 
 enum {
 	LOAD_OK,
-	LOAD_SKIP,
 	LOAD_FAIL,
 };
 
@@ -88,78 +96,104 @@ err:
 	return LOAD_FAIL;
 }
 
+/* Evaluate the toplevel functions of a module loaded from its cache */
+static unsigned int load_forms(struct sheep_vm *vm, sheep_t forms)
+{
+	struct sheep_vector *array = sheep_array(forms);
+	unsigned int ret = LOAD_OK;
+	unsigned long i;
+
+	sheep_protect(vm, forms);
+	for (i = 0; i < array->nr_items; i++) {
+		if (!sheep_eval(vm, array->items[i])) {
+			ret = LOAD_FAIL;
+			break;
+		}
+	}
+	sheep_unprotect(vm, forms);
+	return ret;
+}
+
+/*
+ * A module is loaded from the compiled code cached next to its
+ * source if the cache is fresh.  Otherwise it is compiled and the
+ * cache is written for the next time.
+ */
 static unsigned int load_sheep(struct sheep_vm *vm,
 			       const char *path,
 			       struct sheep_module *mod)
 {
+	struct sheep_bytecode bytecode;
 	struct sheep_reader reader;
+	unsigned long hash;
 	int ret = LOAD_FAIL;
-	FILE *fp;
-
-	fp = fopen(path, "r");
-	if (!fp)
+	sheep_t forms;
+	char *cache;
+
+	if (sheep_reader_open(&reader, path))
+		return LOAD_FAIL;
+
+	cache = sheep_malloc(strlen(path) + 2);
+	sprintf(cache, "%sc", path);
+	hash = sheep_hash(reader.data, reader.size);
+	forms = sheep_bytecode_load(vm, mod, cache, path, hash, reader.size);
+	if (forms) {
+		ret = load_forms(vm, forms);
 		goto out;
+	}
 
-	sheep_reader_init(&reader, path, fp);
+	sheep_bytecode_init(&bytecode, vm);
 	while (1) {
 		struct sheep_expr *expr;
+		unsigned long nr_globals;
 		sheep_t fun;
 
 		expr = sheep_read(&reader, vm);
 		if (!expr)
-			goto out_file;
+			goto out_bytecode;
 		if (expr->object == &sheep_eof) {
 			sheep_free_expr(expr);
 			break;
 		}
+		nr_globals = mod->globals.nr_items / 2;
 		fun = __sheep_compile(vm, mod, expr);
 		sheep_free_expr(expr);
 		if (!fun)
-			goto out_file;
+			goto out_bytecode;
+		sheep_bytecode_add(&bytecode, vm, mod, nr_globals, fun);
 		if (!sheep_eval(vm, fun))
-			goto out_file;
+			goto out_bytecode;
 	}
+	sheep_bytecode_write(&bytecode, cache, hash, reader.size);
 	ret = LOAD_OK;
-out_file:
-	fclose(fp);
+out_bytecode:
+	sheep_bytecode_exit(&bytecode);
 out:
+	sheep_free(cache);
+	sheep_reader_close(&reader);
 	return ret;
 }
 
-static unsigned int module_load(struct sheep_vm *vm,
-				const char *path,
-				const char *name,
-				struct sheep_module *mod)
-{
-	char filename[1024];
-
-	snprintf(filename, sizeof(filename), "%s/%s.so", path, name);
-	if (!access(filename, R_OK))
-		return load_so(vm, filename, mod);
-
-	snprintf(filename, sizeof(filename), "%s/%s.sheep", path, name);
-	if (!access(filename, R_OK))
-		return load_sheep(vm, filename, mod);
-
-	return LOAD_SKIP;
-}
+enum {
+	MODULE_SO,
+	MODULE_SHEEP,
+};
 
 static unsigned int load_path;
 
-sheep_t sheep_module_load(struct sheep_vm *vm, const char *name)
+/* Find the file of module @name along `load-path' */
+static int module_find(struct sheep_vm *vm,
+		       const char *name,
+		       char *filename,
+		       size_t size)
 {
-	struct sheep_module *mod;
 	struct sheep_list *paths;
 	sheep_t paths_;
 
-	mod = sheep_zalloc(sizeof(struct sheep_module));
-	mod->name = sheep_strdup(name);
-	sheep_module_variable(vm, mod, "module", sheep_make_string(vm, name));
-
 	paths_ = vm->globals.items[load_path];
 	if (sheep_type(paths_) != &sheep_list_type) {
 		sheep_error(vm, "`load-path' is not a list");
-		goto err;
+		return -1;
 	}
 
 	paths = sheep_list(paths_);
@@ -168,27 +202,110 @@ sheep_t sheep_module_load(struct sheep_vm *vm, const char *name)
 
 		if (sheep_type(paths->head) != &sheep_string_type) {
 			sheep_error(vm, "bogus paths in `load-path'");
-			goto err;
+			return -1;
 		}
 
 		path = sheep_rawstring(paths->head);
-		switch (module_load(vm, path, name, mod)) {
-		case LOAD_OK:
-			goto found;
-		case LOAD_FAIL:
-			goto err;
-		case LOAD_SKIP:
-		default:
-			paths = sheep_list(paths->tail);
-		}
+		snprintf(filename, size, "%s/%s.so", path, name);
+		if (!access(filename, R_OK))
+			return MODULE_SO;
+
+		snprintf(filename, size, "%s/%s.sheep", path, name);
+		if (!access(filename, R_OK))
+			return MODULE_SHEEP;
+
+		paths = sheep_list(paths->tail);
 	}
 
 	sheep_error(vm, "module `%s' not found", name);
-err:
+	return -1;
+}
+
+/* The module in @slot, which is still nil while it is loading */
+static sheep_t loaded_module(struct sheep_vm *vm,
+			     const char *name,
+			     unsigned long slot)
+{
+	sheep_t sheep = vm->globals.items[slot];
+
+	if (sheep == &sheep_nil) {
+		sheep_error(vm, "module `%s' is loaded recursively", name);
+		return NULL;
+	}
+	return sheep;
+}
+
+/* Code of a failed module may live on, but not its bindings */
+static void drop_module(struct sheep_vm *vm, struct sheep_module *mod)
+{
+	unsigned long i;
+
+	for (i = 0; i < mod->globals.nr_items; i += 2) {
+		unsigned long slot = (unsigned long)mod->globals.items[i];
+
+		vm->globals.items[slot] = &sheep_nil;
+	}
 	free_module(mod);
-	return NULL;
-found:
-	return sheep_make_object(vm, &sheep_module_type, mod);
+}
+
+/*
+ * Modules are loaded only once, later loads of the same name or of
+ * the same file under another name return the loaded module.  @name
+ * must be interned.
+ */
+sheep_t sheep_module_load(struct sheep_vm *vm, const char *name)
+{
+	char filename[PATH_MAX], resolved[PATH_MAX];
+	struct sheep_module *mod;
+	const char *path;
+	unsigned int slot;
+	sheep_t sheep;
+	int kind, ret;
+	void *entry;
+
+	if (!sheep_map_get(&vm->modules, name, &entry))
+		return loaded_module(vm, name, (unsigned long)entry);
+
+	kind = module_find(vm, name, filename, sizeof(filename));
+	if (kind < 0)
+		return NULL;
+
+	if (realpath(filename, resolved))
+		path = sheep_intern(vm, resolved);
+	else
+		path = sheep_intern(vm, filename);
+
+	if (!sheep_map_get(&vm->modules, path, &entry)) {
+		sheep = loaded_module(vm, name, (unsigned long)entry);
+		if (sheep)
+			sheep_map_set(&vm->modules, name, entry);
+		return sheep;
+	}
+
+	/* Registered up front, so that cycles are caught */
+	slot = sheep_vm_global(vm);
+	sheep_map_set(&vm->modules, name, (void *)(unsigned long)slot);
+	sheep_map_set(&vm->modules, path, (void *)(unsigned long)slot);
+
+	mod = sheep_zalloc(sizeof(struct sheep_module));
+	mod->name = sheep_strdup(name);
+	mod->id = sheep_cache_id();
+	sheep_module_variable(vm, mod, "module", sheep_make_string(vm, name));
+
+	if (kind == MODULE_SO)
+		ret = load_so(vm, filename, mod);
+	else
+		ret = load_sheep(vm, filename, mod);
+	if (ret != LOAD_OK) {
+		drop_module(vm, mod);
+		sheep_map_del(&vm->modules, name);
+		sheep_map_del(&vm->modules, path);
+		return NULL;
+	}
+
+	sheep = sheep_make_object(vm, &sheep_module_type, mod);
+	vm->globals.items[slot] = sheep;
+	return sheep;
 }
 
 unsigned int sheep_module_variable(struct sheep_vm *vm,
@@ -198,8 +315,10 @@ unsigned int sheep_module_variable(struct sheep_vm *vm,
 {
 	unsigned int slot;
 
+	name = sheep_intern(vm, name);
 	slot = sheep_vector_push(&vm->globals, sheep);
 	sheep_map_set(&module->env, name, (void *)(unsigned long)slot);
+	sheep_module_global(module, slot, name);
 	return slot;
 }
 
@@ -216,9 +335,18 @@ void sheep_module_function(struct sheep_vm *vm,
 
 static sheep_t builtin_load_path(struct sheep_vm *vm)
 {
-	return sheep_make_list(vm, 2,
-			sheep_make_string(vm, "."),
-			sheep_make_string(vm, SHEEP_MODDIR));
+	sheep_t cwd, moddir, list;
+
+	cwd = sheep_make_string(vm, ".");
+	sheep_protect(vm, cwd);
+	moddir = sheep_make_string(vm, SHEEP_MODDIR);
+	sheep_protect(vm, moddir);
+
+	list = sheep_make_list(vm, 2, cwd, moddir);
+
+	sheep_unprotect(vm, moddir);
+	sheep_unprotect(vm, cwd);
+	return list;
 }
 
 void sheep_module_builtins(struct sheep_vm *vm)
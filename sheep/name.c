@@ -6,6 +6,7 @@
 #include <sheep/compile.h>
 #include <sheep/object.h>
 #include <sheep/util.h>
+#include <sheep/gc.h>
 #include <sheep/vm.h>
 #include <string.h>
 #include <stdio.h>
@@ -17,9 +18,8 @@ static void name_free(struct sheep_vm *vm, sheep_t sheep)
 	struct sheep_name *name;
 
 	name = sheep_name(sheep);
-	sheep_free(*name->parts);
-	sheep_free(name->parts);
-	sheep_free(name);
+	if (name->parts != (const char **)(name + 1))
+		sheep_free(name->parts);
 }
 
 static int name_equal(sheep_t a, sheep_t b)
@@ -34,11 +34,20 @@ static int name_equal(sheep_t a, sheep_t b)
 		return 0;
 
 	for (i = 0; i < na->nr_parts; i++)
-		if (strcmp(na->parts[i], nb->parts[i]))
+		if (na->parts[i] != nb->parts[i])
 			return 0;
 	return 1;
 }
 
+/* The parts are interned, their addresses identify them */
+static unsigned long name_hash(sheep_t sheep)
+{
+	struct sheep_name *name;
+
+	name = sheep_name(sheep);
+	return sheep_hash(name->parts, sizeof(char *) * name->nr_parts);
+}
+
 static void name_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
 {
 	struct sheep_name *name;
@@ -55,34 +64,138 @@ const struct sheep_type sheep_name_type = {
 	.free = name_free,
 	.compile = sheep_compile_name,
 	.equal = name_equal,
+	.hash = name_hash,
 	.format = name_format,
 };
 
+static unsigned int count_parts(const char *work)
+{
+	unsigned int nr_parts = 1;
+	const char *p;
+
+	while ((p = strchr(work, ':')) && p[1]) {
+		if (p != work)
+			nr_parts++;
+		work = p + 1;
+	}
+	return nr_parts;
+}
+
+/*
+ * The parts vector is allocated inline with the object if it fits,
+ * or in a separate block otherwise.
+ */
 sheep_t sheep_make_name(struct sheep_vm *vm, const char *string)
 {
+	unsigned int nr_parts, part = 0;
+	const char *work, *start, *p;
 	struct sheep_name *name;
-	char *work;
+	sheep_t sheep;
+	size_t size;
 
-	name = sheep_malloc(sizeof(struct sheep_name));
-	name->parts = sheep_malloc(sizeof(char *));
-	name->parts[0] = work = sheep_strdup(string);
-	name->nr_parts = 1;
+	nr_parts = count_parts(string);
+	size = sizeof(char *) * nr_parts;
 
-	while (1) {
-		char *p;
+	if (sizeof(struct sheep_name) + size <= SHEEP_INLINE_MAX) {
+		sheep = __sheep_make_object(vm, &sheep_name_type,
+					sizeof(struct sheep_name) + size);
+		name = sheep_name(sheep);
+		name->parts = (const char **)(name + 1);
+	} else {
+		sheep = __sheep_make_object(vm, &sheep_name_type,
+					sizeof(struct sheep_name));
+		name = sheep_name(sheep);
+		name->parts = sheep_malloc(size);
+	}
+	name->nr_parts = nr_parts;
 
-		p = strchr(work, ':');
-		if (!p || p[1] == 0)
-			return sheep_make_object(vm, &sheep_name_type, name);
-		if (p == work) {
-			work++;
-			continue;
+	work = start = string;
+	while ((p = strchr(work, ':')) && p[1]) {
+		if (p != work) {
+			name->parts[part++] = __sheep_intern(vm, start,
+							     p - start);
+			start = p + 1;
 		}
-		*p = 0;
 		work = p + 1;
-		name->nr_parts++;
-		name->parts = sheep_realloc(name->parts,
-					sizeof(char *) * name->nr_parts);
-		name->parts[name->nr_parts - 1] = work;
 	}
+	name->parts[part] = sheep_intern(vm, start);
+	return sheep;
+}
+
+#define SYMBOLS_MIN	256
+
+static unsigned int hash(const char *string, size_t len)
+{
+	unsigned int key = 0;
+
+	while (len--)
+		key += (key << 5) + *string++;
+	return key;
+}
+
+static void grow_symbols(struct sheep_symbols *symbols)
+{
+	unsigned int i, size, mask;
+	char **table;
+
+	size = symbols->size ? symbols->size * 2 : SYMBOLS_MIN;
+	mask = size - 1;
+	table = sheep_zalloc(sizeof(char *) * size);
+
+	for (i = 0; i < symbols->size; i++) {
+		char *symbol = symbols->table[i];
+		unsigned int index;
+
+		if (!symbol)
+			continue;
+		index = hash(symbol, strlen(symbol)) & mask;
+		while (table[index])
+			index = (index + 1) & mask;
+		table[index] = symbol;
+	}
+
+	sheep_free(symbols->table);
+	symbols->table = table;
+	symbols->size = size;
+}
+
+/* The interned copy of the @len bytes at @string, which has no NULs */
+const char *__sheep_intern(struct sheep_vm *vm, const char *string, size_t len)
+{
+	struct sheep_symbols *symbols = &vm->symbols;
+	unsigned int index, mask;
+	char *symbol;
+
+	if (symbols->nr_symbols * 2 >= symbols->size)
+		grow_symbols(symbols);
+
+	mask = symbols->size - 1;
+	index = hash(string, len) & mask;
+	while ((symbol = symbols->table[index])) {
+		if (strnlen(symbol, len + 1) == len &&
+		    !memcmp(symbol, string, len))
+			return symbol;
+		index = (index + 1) & mask;
+	}
+
+	symbol = sheep_malloc(len + 1);
+	memcpy(symbol, string, len);
+	symbol[len] = 0;
+	symbols->table[index] = symbol;
+	symbols->nr_symbols++;
+	return symbol;
+}
+
+const char *sheep_intern(struct sheep_vm *vm, const char *string)
+{
+	return __sheep_intern(vm, string, strlen(string));
+}
+
+void sheep_symbols_exit(struct sheep_vm *vm)
+{
+	unsigned int i;
+
+	for (i = 0; i < vm->symbols.size; i++)
+		sheep_free(vm->symbols.table[i]);
+	sheep_free(vm->symbols.table);
 }
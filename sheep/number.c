@@ -4,6 +4,8 @@
  * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
  */
 #include <sheep/compile.h>
+#include <sheep/bignum.h>
+#include <sheep/flonum.h>
 #include <sheep/object.h>
 #include <sheep/string.h>
 #include <sheep/unpack.h>
@@ -12,7 +14,9 @@
 #include <sheep/vm.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <stdio.h>
+#include <math.h>
 
 #include <sheep/number.h>
 
@@ -37,23 +41,25 @@ const struct sheep_type sheep_number_type = {
 	.format = number_format,
 };
 
+/* Make an integer, promoted to a bignum if it does not fit a fixnum */
 sheep_t sheep_make_number(struct sheep_vm *vm, long number)
 {
+	if (number < SHEEP_FIXNUM_MIN || number > SHEEP_FIXNUM_MAX)
+		return sheep_bignum_from_long(vm, number);
 	return (sheep_t)((number << 1) | 1);
 }
 
 int sheep_parse_number(struct sheep_vm *vm, const char *buf, sheep_t *sheepp)
 {
-	long number, min, max;
+	long number;
 	char *end;
 
+	errno = 0;
 	number = strtol(buf, &end, 0);
-	if (*end)
-		return -1;
-	min = LONG_MIN >> 1;
-	max = LONG_MAX >> 1;
-	if (number < min || number > max)
-		return -2;
+	if (end == buf || *end)
+		return sheep_parse_flonum(vm, buf, sheepp);
+	if (errno == ERANGE)
+		return sheep_parse_bignum(vm, buf, sheepp);
 	*sheepp = sheep_make_number(vm, number);
 	return 0;
 }
@@ -66,7 +72,7 @@ static sheep_t builtin_number(struct sheep_vm *vm, unsigned int nr_args)
 	if (sheep_unpack_stack(vm, nr_args, "o", &sheep))
 		return NULL;
 
-	if (sheep_type(sheep) == &sheep_number_type)
+	if (sheep_is_number(sheep))
 		return sheep;
 
 	if (sheep_type(sheep) == &sheep_string_type) {
@@ -97,24 +103,38 @@ static sheep_t do_cmp(struct sheep_vm *vm,
 		      unsigned int nr_args,
 		      enum relation relation)
 {
-	int result = result;
-	long a, b;
+	int result = result, cmp;
+	sheep_t a, b;
 
-	if (sheep_unpack_stack(vm, nr_args, "NN", &a, &b))
+	if (sheep_unpack_stack(vm, nr_args, "xx", &a, &b))
 		return NULL;
 
+	if (sheep_is_fixnum(a) && sheep_is_fixnum(b))
+		cmp = (sheep_fixnum(a) > sheep_fixnum(b)) -
+			(sheep_fixnum(a) < sheep_fixnum(b));
+	else if (sheep_is_flonum(a) || sheep_is_flonum(b)) {
+		double x = sheep_number_double(a);
+		double y = sheep_number_double(b);
+
+		/* Nothing compares to NaN */
+		if (isnan(x) || isnan(y))
+			return &sheep_false;
+		cmp = (x > y) - (x < y);
+	} else
+		cmp = sheep_bignum_cmp(a, b);
+
 	switch (relation) {
 	case LESS:
-		result = a < b;
+		result = cmp < 0;
 		break;
 	case LESSEQ:
-		result = a <= b;
+		result = cmp <= 0;
 		break;
 	case MOREEQ:
-		result = a >= b;
+		result = cmp >= 0;
 		break;
 	case MORE:
-		result = a > b;
+		result = cmp > 0;
 		break;
 	}
 
@@ -147,31 +167,97 @@ static sheep_t builtin_more(struct sheep_vm *vm, unsigned int nr_args)
 	return do_cmp(vm, nr_args, MORE);
 }
 
-static sheep_t do_binop(struct sheep_vm *vm,
+/* Arithmetic with at least one flonum operand yields a flonum */
+static sheep_t do_flonum(struct sheep_vm *vm, sheep_t a, sheep_t b,
+			 char operation)
+{
+	double x = sheep_number_double(a);
+	double y = sheep_number_double(b);
+
+	switch (operation) {
+	case '+':
+		return sheep_make_flonum(vm, x + y);
+	case '-':
+		return sheep_make_flonum(vm, x - y);
+	case '*':
+		return sheep_make_flonum(vm, x * y);
+	case '/':
+		return sheep_make_flonum(vm, x / y);
+	case '%':
+		return sheep_make_flonum(vm, fmod(x, y));
+	default:
+		sheep_bug("unknown arithmetic operation");
+	}
+}
+
+/*
+ * Arithmetic on numbers, with the fixnum cases handled directly.
+ * Integer results that do not fit a fixnum are promoted to bignums.
+ */
+static sheep_t do_arith(struct sheep_vm *vm,
 			unsigned int nr_args,
 			char operation)
 {
-	long value, a, b;
+	sheep_t a, b, result;
 
-	if (sheep_unpack_stack(vm, nr_args, "NN", &a, &b))
+	if (sheep_unpack_stack(vm, nr_args, "xx", &a, &b))
 		return NULL;
 
+	if (sheep_is_flonum(a) || sheep_is_flonum(b))
+		return do_flonum(vm, a, b, operation);
+
 	switch (operation) {
 	case '+':
-		value = a + b;
-		break;
+		if (sheep_is_fixnum(a) && sheep_is_fixnum(b) &&
+		    !sheep_fixnum_add(a, b, &result))
+			return result;
+		return sheep_bignum_add(vm, a, b);
 	case '-':
-		value = a - b;
-		break;
+		if (sheep_is_fixnum(a) && sheep_is_fixnum(b) &&
+		    !sheep_fixnum_sub(a, b, &result))
+			return result;
+		return sheep_bignum_sub(vm, a, b);
 	case '*':
-		value = a * b;
-		break;
+		if (sheep_is_fixnum(a) && sheep_is_fixnum(b) &&
+		    !sheep_fixnum_mul(a, b, &result))
+			return result;
+		return sheep_bignum_mul(vm, a, b);
 	case '/':
-		value = a / b;
-		break;
 	case '%':
-		value = a % b;
-		break;
+		if (sheep_is_fixnum(a) && sheep_is_fixnum(b) &&
+		    sheep_fixnum(b)) {
+			if (operation == '/')
+				return sheep_make_number(vm, sheep_fixnum(a) /
+							 sheep_fixnum(b));
+			return sheep_make_number(vm, sheep_fixnum(a) %
+						 sheep_fixnum(b));
+		}
+		if (operation == '/') {
+			if (sheep_bignum_divmod(vm, a, b, &result, NULL))
+				return NULL;
+		} else {
+			if (sheep_bignum_divmod(vm, a, b, NULL, &result))
+				return NULL;
+		}
+		return result;
+	default:
+		sheep_bug("unknown arithmetic operation");
+	}
+}
+
+#define LONG_BITS	(sizeof(long) * CHAR_BIT)
+
+/* Bitwise operations, on fixnums only */
+static sheep_t do_binop(struct sheep_vm *vm,
+			unsigned int nr_args,
+			char operation)
+{
+	long value, a, b;
+
+	if (sheep_unpack_stack(vm, nr_args, "NN", &a, &b))
+		return NULL;
+
+	switch (operation) {
 	case '|':
 		value = a | b;
 		break;
@@ -182,9 +268,21 @@ static sheep_t do_binop(struct sheep_vm *vm,
 		value = a ^ b;
 		break;
 	case '<':
-		value = a << b;
+		if (b < 0)
+			goto negative;
+		if (b > UINT_MAX)
+			goto large;
+		/* Shifts that lose bits are promoted */
+		if ((unsigned long)b >= LONG_BITS - 1 ||
+		    (long)((unsigned long)a << b) >> b != a)
+			return sheep_bignum_shl(vm, sheep_make_number(vm, a), b);
+		value = (long)((unsigned long)a << b);
 		break;
 	case '>':
+		if (b < 0)
+			goto negative;
+		if ((unsigned long)b >= LONG_BITS)
+			b = LONG_BITS - 1;
 		value = a >> b;
 		break;
 	default:
@@ -192,44 +290,54 @@ static sheep_t do_binop(struct sheep_vm *vm,
 	}
 
 	return sheep_make_number(vm, value);
+negative:
+	sheep_error(vm, "negative shift count");
+	return NULL;
+large:
+	sheep_error(vm, "shift count too large");
+	return NULL;
 }
 
 /* (+ a b) */
 static sheep_t builtin_plus(struct sheep_vm *vm, unsigned int nr_args)
 {
-	return do_binop(vm, nr_args, '+');
+	return do_arith(vm, nr_args, '+');
 }
 
 /* (- a &optional b) */
 static sheep_t builtin_minus(struct sheep_vm *vm, unsigned int nr_args)
 {
 	if (nr_args == 1) {
-		long number;
+		sheep_t number;
 
-		if (sheep_unpack_stack(vm, nr_args, "N", &number))
+		if (sheep_unpack_stack(vm, nr_args, "x", &number))
 			return NULL;
-		return sheep_make_number(vm, -number);
+		if (sheep_is_fixnum(number))
+			return sheep_make_number(vm, -sheep_fixnum(number));
+		if (sheep_is_flonum(number))
+			return sheep_make_flonum(vm, -sheep_flonum(number));
+		return sheep_bignum_neg(vm, number);
 	}
 
-	return do_binop(vm, nr_args, '-');
+	return do_arith(vm, nr_args, '-');
 }
 
 /* (* a b) */
 static sheep_t builtin_multiply(struct sheep_vm *vm, unsigned int nr_args)
 {
-	return do_binop(vm, nr_args, '*');
+	return do_arith(vm, nr_args, '*');
 }
 
 /* (/ a b) */
 static sheep_t builtin_divide(struct sheep_vm *vm, unsigned int nr_args)
 {
-	return do_binop(vm, nr_args, '/');
+	return do_arith(vm, nr_args, '/');
 }
 
 /* (% a b) */
 static sheep_t builtin_modulo(struct sheep_vm *vm, unsigned int nr_args)
 {
-	return do_binop(vm, nr_args, '%');
+	return do_arith(vm, nr_args, '%');
 }
 
 /* (~ number) */
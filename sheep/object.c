@@ -26,6 +26,22 @@ sheep_t sheep_make_object(struct sheep_vm *vm,
 	return sheep;
 }
 
+/*
+ * Allocate an object with @size bytes of payload that is stored
+ * right behind the object header.  The payload is not initialized.
+ */
+sheep_t __sheep_make_object(struct sheep_vm *vm,
+			    const struct sheep_type *type,
+			    size_t size)
+{
+	struct sheep_object *sheep;
+
+	sheep = __sheep_gc_alloc(vm, size);
+	sheep->type = type;
+	sheep->data = (unsigned long)sheep_inline_data(sheep);
+	return sheep;
+}
+
 int sheep_test(sheep_t sheep)
 {
 	if (sheep_type(sheep)->test)
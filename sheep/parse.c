@@ -22,21 +22,11 @@ void sheep_parser_error(struct sheep_compile *compile,
 {
 	struct sheep_expr *expr = compile->expr;
 	const char *repr;
-	size_t position;
 	va_list ap;
 
-	if (sheep_type(expr->object) == &sheep_list_type) {
-		struct sheep_list *list = sheep_list(expr->object);
-
-		position = 1; /* list itself is at 0 */
-		sheep_list_search(list, culprit, &position);
-	} else
-		position = 0;
-
 	repr = sheep_repr(culprit);
 	fprintf(stderr, "%s:%lu: %s: ", expr->filename,
-		(unsigned long)expr->lines.items[position],
-		repr);
+		sheep_expr_line(expr, culprit), repr);
 	sheep_free(repr);
 
 	va_start(ap, fmt);
@@ -6,10 +6,17 @@
 #include <sheep/number.h>
 #include <sheep/object.h>
 #include <sheep/string.h>
+#include <sheep/array.h>
 #include <sheep/list.h>
 #include <sheep/name.h>
 #include <sheep/gc.h>
 #include <sheep/vm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <ctype.h>
 #include <stdio.h>
 
@@ -26,6 +33,25 @@ static int next(struct sheep_reader *reader, int raw)
 {
 	int c, comment = 0;
 
+	if (!reader->file) {
+		const char *pos = reader->pos;
+
+		while (pos < reader->end) {
+			c = (unsigned char)*pos++;
+			if (c == '\n') {
+				reader->lineno++;
+				comment = 0;
+			} else if (c == '#')
+				comment = 1;
+			if (raw || !(isspace(c) || comment)) {
+				reader->pos = pos;
+				return c;
+			}
+		}
+		reader->pos = pos;
+		return EOF;
+	}
+
 	do {
 		c = fgetc(reader->file);
 		if (c == '\n') {
@@ -39,81 +65,213 @@ static int next(struct sheep_reader *reader, int raw)
 
 static void prev(struct sheep_reader *reader, int c)
 {
+	if (!reader->file) {
+		if (c != EOF && *--reader->pos == '\n')
+			reader->lineno--;
+		return;
+	}
 	if (ungetc(c, reader->file) == '\n')
 		reader->lineno--;
 }
 
-static int issep(int c, int string)
+static int issep(int c)
 {
 	if (c == EOF)
 		return 1;
-	if (string && c == '"')
+	if (c == ')' || c == '(' || isspace(c))
 		return 1;
-	if (!string && (c == ')' || c == '(' || isspace(c)))
+	if (c == ']' || c == '[')
 		return 1;
 	return 0;
 }
 
-static int read_token(struct sheep_reader *reader,
-		      char *buf,
-		      int len,
-		      int string)
+/* Tokens of any length, kept on the stack while they are short */
+struct token {
+	char *bytes;
+	size_t len;
+	size_t size;
+	char buf[128];
+};
+
+static void token_init(struct token *token)
+{
+	token->bytes = token->buf;
+	token->len = 0;
+	token->size = sizeof(token->buf);
+}
+
+static void token_addn(struct token *token, const char *str, size_t n)
 {
-	int i, c = c;
+	if (token->len + n + 1 > token->size) {
+		size_t size = token->size;
 
-	for (i = 0; i < len; i++) {
-		c = next(reader, 1);
-		if (string && c == EOF) {
-			barf(reader, "end of file while reading string");
-			return -1;
-		}
-		if (issep(c, string))
-			break;
-		buf[i] = c;
+		while (token->len + n + 1 > size)
+			size *= 2;
+		if (token->bytes == token->buf) {
+			token->bytes = sheep_malloc(size);
+			memcpy(token->bytes, token->buf, token->len);
+		} else
+			token->bytes = sheep_realloc(token->bytes, size);
+		token->size = size;
 	}
-	buf[i] = 0;
-	if (!string)
-		prev(reader, c);
+	memcpy(token->bytes + token->len, str, n);
+	token->len += n;
+	token->bytes[token->len] = 0;
+}
+
+static void token_add(struct token *token, char c)
+{
+	token_addn(token, &c, 1);
+}
+
+static void token_free(struct token *token)
+{
+	if (token->bytes != token->buf)
+		sheep_free(token->bytes);
+}
+
+/* Unknown escapes are kept as they are, like in regex patterns */
+static int read_escape(struct sheep_reader *reader, struct token *token)
+{
+	int c = next(reader, 1);
+
+	switch (c) {
+	case 'n':
+		token_add(token, '\n');
+		return 0;
+	case 't':
+		token_add(token, '\t');
+		return 0;
+	case 'r':
+		token_add(token, '\r');
+		return 0;
+	case '"':
+	case '\\':
+		token_add(token, c);
+		return 0;
+	case EOF:
+		barf(reader, "end of file while reading string");
+		return -1;
+	}
+	token_add(token, '\\');
+	token_add(token, c);
 	return 0;
 }
 
 static sheep_t read_string(struct sheep_reader *reader, struct sheep_vm *vm)
 {
-	char buf[512];
+	struct token token;
+	sheep_t sheep;
+	int c;
 
-	if (read_token(reader, buf, 512, 1))
-		return NULL;
-	return sheep_make_string(vm, buf);
+	token_init(&token);
+	if (!reader->file) {
+		const char *pos;
+
+		for (pos = reader->pos; pos < reader->end; pos++) {
+			if (*pos == '"' || *pos == '\\')
+				break;
+			if (*pos == '\n')
+				reader->lineno++;
+		}
+		/* Without escapes, the literal is copied straight out */
+		if (pos < reader->end && *pos == '"') {
+			sheep = sheep_copy_string(vm, reader->pos,
+						  pos - reader->pos);
+			reader->pos = pos + 1;
+			return sheep;
+		}
+		token_addn(&token, reader->pos, pos - reader->pos);
+		reader->pos = pos;
+	}
+
+	while ((c = next(reader, 1)) != '"') {
+		if (c == EOF) {
+			barf(reader, "end of file while reading string");
+			goto err;
+		}
+		if (c != '\\')
+			token_add(&token, c);
+		else if (read_escape(reader, &token))
+			goto err;
+	}
+	sheep = sheep_copy_string(vm, token.bytes, token.len);
+	token_free(&token);
+	return sheep;
+err:
+	token_free(&token);
+	return NULL;
 }
 
 static sheep_t read_atom(struct sheep_reader *reader,
 			 struct sheep_vm *vm,
 			 int c)
 {
+	struct token token;
 	sheep_t sheep;
-	char buf[512];
 
-	buf[0] = c;
-	if (read_token(reader, buf + 1, 511, 0) < 0)
-		return NULL;
-	switch (sheep_parse_number(vm, buf, &sheep)) {
+	token_init(&token);
+	if (!reader->file) {
+		/* @c is still right before the reader position */
+		const char *start = reader->pos - 1, *pos;
+
+		for (pos = reader->pos; pos < reader->end; pos++)
+			if (issep((unsigned char)*pos))
+				break;
+		token_addn(&token, start, pos - start);
+		reader->pos = pos;
+	} else {
+		do {
+			token_add(&token, c);
+			c = next(reader, 1);
+		} while (!issep(c));
+		prev(reader, c);
+	}
+
+	switch (sheep_parse_number(vm, token.bytes, &sheep)) {
 	case 0:
-		return sheep;
+		break;
 	case -1:
-		return sheep_make_name(vm, buf);
-	case -2:
-		barf(reader, "number literal too large");
+		sheep = sheep_make_name(vm, token.bytes);
+		break;
+	default:
+		sheep = NULL;
 	}
-	return NULL;
+	token_free(&token);
+	return sheep;
+}
+
+/*
+ * The locations are keyed by object identity, not by strings.  This
+ * relies on struct sheep_map comparing and hashing the key pointers
+ * and never looking at what they point to.
+ */
+static int get_location(struct sheep_map *locations,
+			sheep_t sheep,
+			unsigned long *linenop)
+{
+	void *entry;
+
+	if (sheep_map_get(locations, (const char *)sheep, &entry))
+		return -1;
+	*linenop = (unsigned long)entry;
+	return 0;
+}
+
+static void set_location(struct sheep_map *locations,
+			 sheep_t sheep,
+			 unsigned long lineno)
+{
+	sheep_map_set(locations, (const char *)sheep, (void *)lineno);
 }
 
 static sheep_t read_sexp(struct sheep_reader *reader,
-			 struct sheep_vector *lines,
+			 struct sheep_map *locations,
 			 struct sheep_vm *vm,
 			 int c);
 
 static sheep_t read_list(struct sheep_reader *reader,
-			 struct sheep_vector *lines,
+			 struct sheep_map *locations,
 			 struct sheep_vm *vm)
 {
 	sheep_t list, pos;
@@ -123,51 +281,170 @@ static sheep_t read_list(struct sheep_reader *reader,
 	sheep_protect(vm, list);
 
 	for (c = next(reader, 0); c != EOF; c = next(reader, 0)) {
-		struct sheep_list *node;
+		sheep_t item;
 
 		if (c == ')') {
 			sheep_unprotect(vm, list);
 			return list;
 		}
 
-		node = sheep_list(pos);
-		node->head = read_sexp(reader, lines, vm, c);
-		if (!node->head)
-			return NULL;
-		if (node->head == &sheep_eof)
+		item = read_sexp(reader, locations, vm, c);
+		if (!item)
+			goto out;
+		if (item == &sheep_eof)
 			break;
-		pos = node->tail = sheep_make_cons(vm, NULL, NULL);
+		pos = sheep_list_append(vm, pos, item);
 	}
 
 	barf(reader, "end of file while reading list");
+out:
 	sheep_unprotect(vm, list);
 	return NULL;
 }
 
+static sheep_t read_array(struct sheep_reader *reader,
+			  struct sheep_map *locations,
+			  struct sheep_vm *vm)
+{
+	sheep_t array;
+	int c;
+
+	array = sheep_make_array(vm, 0, NULL);
+	sheep_protect(vm, array);
+
+	for (c = next(reader, 0); c != EOF; c = next(reader, 0)) {
+		sheep_t item;
+
+		if (c == ']') {
+			sheep_unprotect(vm, array);
+			return array;
+		}
+
+		item = read_sexp(reader, locations, vm, c);
+		if (!item)
+			goto out;
+		if (item == &sheep_eof)
+			break;
+		sheep_array_push(vm, array, item);
+	}
+
+	barf(reader, "end of file while reading vector");
+out:
+	sheep_unprotect(vm, array);
+	return NULL;
+}
+
 static sheep_t read_sexp(struct sheep_reader *reader,
-			 struct sheep_vector *lines,
+			 struct sheep_map *locations,
 			 struct sheep_vm *vm,
 			 int c)
 {
+	unsigned long lineno = reader->lineno, first;
+	sheep_t sheep;
+
 	if (c == EOF)
 		return &sheep_eof;
 
-	sheep_vector_push(lines, (void *)reader->lineno);
-
 	if (c == '"')
-		return read_string(reader, vm);
+		sheep = read_string(reader, vm);
 	else if (c == '(')
-		return read_list(reader, lines, vm);
+		sheep = read_list(reader, locations, vm);
+	else if (c == '[')
+		sheep = read_array(reader, locations, vm);
 	else if (c == ')') {
 		barf(reader, "stray closing parenthesis");
 		return NULL;
+	} else if (c == ']') {
+		barf(reader, "stray closing bracket");
+		return NULL;
+	} else
+		sheep = read_atom(reader, vm, c);
+
+	/* Immediates can occur more than once, the first one counts */
+	if (sheep && get_location(locations, sheep, &first))
+		set_location(locations, sheep, lineno);
+	return sheep;
+}
+
+/*
+ * Map @filename for reading, or read it into memory if it can not
+ * be mapped, like pipes.  Returns -1 with errno set on failure.
+ */
+int sheep_reader_open(struct sheep_reader *reader, const char *filename)
+{
+	size_t size = 0, alloc = 0;
+	struct stat st;
+	char *data;
+	ssize_t n;
+	int fd, err;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st))
+		goto err;
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			close(fd);
+			sheep_reader_init_buffer(reader, filename, data,
+						 st.st_size);
+			reader->data = data;
+			reader->size = st.st_size;
+			reader->mapped = 1;
+			return 0;
+		}
 	}
-	return read_atom(reader, vm, c);
+
+	data = NULL;
+	do {
+		if (size == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			data = sheep_realloc(data, alloc);
+		}
+		n = read(fd, data + size, alloc - size);
+		if (n < 0) {
+			sheep_free(data);
+			goto err;
+		}
+		size += n;
+	} while (n);
+	close(fd);
+	sheep_reader_init_buffer(reader, filename, data, size);
+	reader->data = data;
+	reader->size = size;
+	return 0;
+err:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+void sheep_reader_close(struct sheep_reader *reader)
+{
+	if (reader->mapped)
+		munmap(reader->data, reader->size);
+	else
+		sheep_free(reader->data);
+	reader->data = NULL;
+}
+
+/* The line of @sheep in @expr, or of the whole expression */
+unsigned long sheep_expr_line(struct sheep_expr *expr, sheep_t sheep)
+{
+	unsigned long lineno;
+
+	if (get_location(&expr->locations, sheep, &lineno) &&
+	    get_location(&expr->locations, expr->object, &lineno))
+		return 0;
+	return lineno;
 }
 
 void sheep_free_expr(struct sheep_expr *expr)
 {
-	sheep_free(expr->lines.items);
+	sheep_map_drain(&expr->locations);
 	sheep_free(expr);
 }
 
@@ -176,8 +453,9 @@ struct sheep_expr *sheep_read(struct sheep_reader *reader, struct sheep_vm *vm)
 	struct sheep_expr *expr;
 
 	expr = sheep_zalloc(sizeof(struct sheep_expr));
-	expr->filename = reader->filename;
-	expr->object = read_sexp(reader, &expr->lines, vm, next(reader, 0));
+	expr->filename = sheep_intern(vm, reader->filename);
+	expr->object = read_sexp(reader, &expr->locations, vm,
+				 next(reader, 0));
 	if (expr->object)
 		return expr;
 	sheep_free_expr(expr);
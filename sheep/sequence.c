@@ -6,21 +6,27 @@
 #include <sheep/number.h>
 #include <sheep/object.h>
 #include <sheep/unpack.h>
+#include <sheep/table.h>
 #include <sheep/vm.h>
 #include <stdio.h>
 
 #include <sheep/sequence.h>
 
-/* (length sequence) */
+/* (length sequence-or-table) */
 static sheep_t builtin_length(struct sheep_vm *vm, unsigned int nr_args)
 {
 	unsigned int len;
 	sheep_t seq;
 
-	if (sheep_unpack_stack(vm, nr_args, "q", &seq))
+	if (sheep_unpack_stack(vm, nr_args, "o", &seq))
 		return NULL;
 
-	len = sheep_sequence(seq)->length(seq);
+	if (sheep_type(seq) == &sheep_table_type)
+		len = sheep_table(seq)->nr_entries;
+	else if (sheep_unpack(vm, seq, 'q', &seq))
+		return NULL;
+	else
+		len = sheep_sequence(seq)->length(seq);
 	return sheep_make_number(vm, len);
 }
 
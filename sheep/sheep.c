@@ -14,16 +14,13 @@ static int do_file(int ac, char **av)
 	struct sheep_reader reader;
 	struct sheep_vm vm;
 	int ret = 1;
-	FILE *in;
 
-	in = fopen(av[0], "r");
-	if (!in) {
+	if (sheep_reader_open(&reader, av[0])) {
 		perror(av[0]);
 		return 1;
 	}
 
 	sheep_vm_init(&vm, ac, av);
-	sheep_reader_init(&reader, av[0], in);
 	while (1) {
 		struct sheep_expr *expr;
 		sheep_t fun, val;
@@ -45,7 +42,7 @@ static int do_file(int ac, char **av)
 	}
 	ret = 0;
 out:
-	fclose(in);
+	sheep_reader_close(&reader);
 	sheep_vm_exit(&vm);
 	return ret;
 }
@@ -14,13 +14,18 @@
 
 #include <sheep/string.h>
 
+static int string_inline(struct sheep_string *string)
+{
+	return string->bytes == (const char *)(string + 1);
+}
+
 static void string_free(struct sheep_vm *vm, sheep_t sheep)
 {
 	struct sheep_string *string;
 
 	string = sheep_string(sheep);
-	sheep_free(string->bytes);
-	sheep_free(string);
+	if (!string_inline(string))
+		sheep_free(string->bytes);
 }
 
 static int string_test(sheep_t sheep)
@@ -42,12 +47,55 @@ static int string_equal(sheep_t a, sheep_t b)
 	return !memcmp(sa->bytes, sb->bytes, sa->nr_bytes);
 }
 
+static unsigned long string_hash(sheep_t sheep)
+{
+	struct sheep_string *string;
+
+	string = sheep_string(sheep);
+	return sheep_hash(string->bytes, string->nr_bytes);
+}
+
+/* The representation escapes what the reader would not read back */
 static void string_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
 {
-	if (repr)
-		sheep_strbuf_addf(sb, "\"%s\"", sheep_rawstring(sheep));
-	else
-		sheep_strbuf_add(sb, sheep_rawstring(sheep));
+	struct sheep_string *string;
+	size_t i, start = 0;
+
+	string = sheep_string(sheep);
+	if (!repr) {
+		sheep_strbuf_addn(sb, string->bytes, string->nr_bytes);
+		return;
+	}
+
+	sheep_strbuf_add(sb, "\"");
+	for (i = 0; i < string->nr_bytes; i++) {
+		const char *escape;
+
+		switch (string->bytes[i]) {
+		case '\n':
+			escape = "\\n";
+			break;
+		case '\t':
+			escape = "\\t";
+			break;
+		case '\r':
+			escape = "\\r";
+			break;
+		case '"':
+			escape = "\\\"";
+			break;
+		case '\\':
+			escape = "\\\\";
+			break;
+		default:
+			continue;
+		}
+		sheep_strbuf_addn(sb, string->bytes + start, i - start);
+		sheep_strbuf_add(sb, escape);
+		start = i + 1;
+	}
+	sheep_strbuf_addn(sb, string->bytes + start, i - start);
+	sheep_strbuf_add(sb, "\"");
 }
 
 static size_t string_length(sheep_t sheep)
@@ -103,13 +151,12 @@ static sheep_t string_reverse(struct sheep_vm *vm, sheep_t sheep)
 static sheep_t string_nth(struct sheep_vm *vm, size_t n, sheep_t sheep)
 {
 	struct sheep_string *string;
-	char *new;
+	char new = 0;
 
 	string = sheep_string(sheep);
-	new = sheep_zalloc(1 + 1);
 	if (string->nr_bytes > n)
-		new[0] = string->bytes[n];
-	return __sheep_make_string(vm, new, 1);
+		new = string->bytes[n];
+	return sheep_copy_string(vm, &new, 1);
 }
 
 static sheep_t string_slice(struct sheep_vm *vm,
@@ -118,8 +165,6 @@ static sheep_t string_slice(struct sheep_vm *vm,
 			    size_t to)
 {
 	struct sheep_string *string;
-	size_t length = 0;
-	char *new;
 
 	string = sheep_string(sheep);
 	if (to > string->nr_bytes) {
@@ -127,11 +172,7 @@ static sheep_t string_slice(struct sheep_vm *vm,
 			to, string->nr_bytes);
 		return NULL;
 	}
-	length = to - from;
-	new = sheep_malloc(length + 1);
-	memcpy(new, string->bytes + from, length);
-	new[length] = 0;
-	return __sheep_make_string(vm, new, length);
+	return sheep_copy_string(vm, string->bytes + from, to - from);
 }
 
 static sheep_t string_position(struct sheep_vm *vm, sheep_t item, sheep_t sheep)
@@ -166,23 +207,65 @@ const struct sheep_type sheep_string_type = {
 	.compile = sheep_compile_constant,
 	.test = string_test,
 	.equal = string_equal,
+	.hash = string_hash,
 	.format = string_format,
 	.sequence = &string_sequence,
 };
 
+/* Whether a string of @len bytes fits inline with its object */
+static int string_fits(size_t len)
+{
+	return sizeof(struct sheep_string) + len + 1 <= SHEEP_INLINE_MAX;
+}
+
+/* Make a string that takes ownership of the allocated @str */
 sheep_t __sheep_make_string(struct sheep_vm *vm, const char *str, size_t len)
 {
 	struct sheep_string *string;
+	sheep_t sheep;
+
+	if (string_fits(len)) {
+		sheep = sheep_copy_string(vm, str, len);
+		sheep_free(str);
+		return sheep;
+	}
 
-	string = sheep_malloc(sizeof(struct sheep_string));
+	sheep = __sheep_make_object(vm, &sheep_string_type,
+				sizeof(struct sheep_string));
+	string = sheep_string(sheep);
 	string->bytes = str;
 	string->nr_bytes = len;
-	return sheep_make_object(vm, &sheep_string_type, string);
+	return sheep;
+}
+
+/* Make a string from a copy of the @len bytes at @str */
+sheep_t sheep_copy_string(struct sheep_vm *vm, const char *str, size_t len)
+{
+	struct sheep_string *string;
+	sheep_t sheep;
+	char *bytes;
+
+	if (!string_fits(len)) {
+		bytes = sheep_malloc(len + 1);
+		memcpy(bytes, str, len);
+		bytes[len] = 0;
+		return __sheep_make_string(vm, bytes, len);
+	}
+
+	sheep = __sheep_make_object(vm, &sheep_string_type,
+				sizeof(struct sheep_string) + len + 1);
+	string = sheep_string(sheep);
+	bytes = (char *)(string + 1);
+	memcpy(bytes, str, len);
+	bytes[len] = 0;
+	string->bytes = bytes;
+	string->nr_bytes = len;
+	return sheep;
 }
 
 sheep_t sheep_make_string(struct sheep_vm *vm, const char *str)
 {
-	return __sheep_make_string(vm, sheep_strdup(str), strlen(str));
+	return sheep_copy_string(vm, str, strlen(str));
 }
 
 void __sheep_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
@@ -243,8 +326,7 @@ static char *do_split(char **stringp, const char *delim)
 /* (split delimiter string) */
 static sheep_t builtin_split(struct sheep_vm *vm, unsigned int nr_args)
 {
-	sheep_t string_, delim_, list_;
-	struct sheep_list *list;
+	sheep_t string_, delim_, list_, last;
 	const char *delim;
 	char *pos, *orig;
 	int empty;
@@ -255,13 +337,12 @@ static sheep_t builtin_split(struct sheep_vm *vm, unsigned int nr_args)
 	sheep_protect(vm, delim_);
 	pos = orig = sheep_strdup(sheep_rawstring(string_));
 
-	list_ = sheep_make_cons(vm, NULL, NULL);
+	list_ = last = sheep_make_cons(vm, NULL, NULL);
 	sheep_protect(vm, list_);
 
 	delim = sheep_rawstring(delim_);
 	empty = sheep_string(delim_)->nr_bytes == 0;
 
-	list = sheep_list(list_);
 	while (pos) {
 		sheep_t item;
 		/*
@@ -279,9 +360,7 @@ static sheep_t builtin_split(struct sheep_vm *vm, unsigned int nr_args)
 		} else
 			item = sheep_make_string(vm, do_split(&pos, delim));
 
-		list->head = item;
-		list->tail = sheep_make_cons(vm, NULL, NULL);
-		list = sheep_list(list->tail);
+		last = sheep_list_append(vm, last, item);
 	}
 	sheep_free(orig);
 
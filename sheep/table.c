@@ -0,0 +1,362 @@
+/*
+ * sheep/table.c
+ *
+ * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
+ */
+#include <sheep/object.h>
+#include <sheep/string.h>
+#include <sheep/unpack.h>
+#include <sheep/array.h>
+#include <sheep/bool.h>
+#include <sheep/list.h>
+#include <sheep/util.h>
+#include <sheep/gc.h>
+#include <sheep/vm.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sheep/table.h>
+
+/*
+ * Open addressing with linear probing, like struct sheep_map.  The
+ * entries remember the hash of their key, so the table can grow
+ * and the probe sequences can be walked without rehashing keys.
+ */
+
+#define TABLE_MIN	8
+
+static unsigned int table_index(unsigned long hash, unsigned int mask)
+{
+	return ((uint64_t)hash * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+}
+
+static struct sheep_table_entry *find(struct sheep_table_entry *entries,
+				      unsigned int size,
+				      sheep_t key,
+				      unsigned long hash)
+{
+	unsigned int index, mask = size - 1;
+
+	index = table_index(hash, mask);
+	while (entries[index].key) {
+		if (entries[index].hash == hash &&
+		    sheep_equal(entries[index].key, key))
+			break;
+		index = (index + 1) & mask;
+	}
+	return &entries[index];
+}
+
+/* Types without equal() compare by identity, the others need hash() */
+static int hash_key(struct sheep_vm *vm, sheep_t key, unsigned long *hashp)
+{
+	const struct sheep_type *type = sheep_type(key);
+
+	if (type->hash)
+		*hashp = type->hash(key);
+	else if (!type->equal)
+		*hashp = (unsigned long)key;
+	else {
+		sheep_error(vm, "can not use %s as table key", type->name);
+		return -1;
+	}
+	return 0;
+}
+
+static struct sheep_table_entry *lookup(struct sheep_table *table,
+					sheep_t key,
+					unsigned long hash)
+{
+	struct sheep_table_entry *entry;
+
+	if (!table->nr_entries)
+		return NULL;
+	entry = find(table->entries, table->size, key, hash);
+	if (!entry->key)
+		return NULL;
+	return entry;
+}
+
+static void grow(struct sheep_table *table)
+{
+	struct sheep_table_entry *entries;
+	unsigned int i, size;
+
+	size = table->size ? table->size * 2 : TABLE_MIN;
+	entries = sheep_zalloc(sizeof(struct sheep_table_entry) * size);
+	for (i = 0; i < table->size; i++) {
+		struct sheep_table_entry *old = &table->entries[i];
+
+		if (old->key)
+			*find(entries, size, old->key, old->hash) = *old;
+	}
+	sheep_free(table->entries);
+	table->entries = entries;
+	table->size = size;
+}
+
+/* Returns 1 if @key is found, 0 if not, -1 if it can not be a key */
+int sheep_table_get(struct sheep_vm *vm, sheep_t table_, sheep_t key,
+		    sheep_t *valuep)
+{
+	struct sheep_table_entry *entry;
+	unsigned long hash;
+
+	if (hash_key(vm, key, &hash))
+		return -1;
+	entry = lookup(sheep_table(table_), key, hash);
+	if (!entry)
+		return 0;
+	*valuep = entry->value;
+	return 1;
+}
+
+int sheep_table_set(struct sheep_vm *vm, sheep_t table_, sheep_t key,
+		    sheep_t value)
+{
+	struct sheep_table *table = sheep_table(table_);
+	struct sheep_table_entry *entry;
+	unsigned long hash;
+
+	if (hash_key(vm, key, &hash))
+		return -1;
+
+	entry = lookup(table, key, hash);
+	if (!entry) {
+		if ((table->nr_entries + 1) * 4 > table->size * 3)
+			grow(table);
+		entry = find(table->entries, table->size, key, hash);
+		entry->key = key;
+		entry->hash = hash;
+		table->nr_entries++;
+		sheep_write_barrier(vm, table_, key);
+	}
+	entry->value = value;
+	sheep_write_barrier(vm, table_, value);
+	return 0;
+}
+
+/* Returns 1 if @key is removed, 0 if not found, -1 on error */
+int sheep_table_del(struct sheep_vm *vm, sheep_t table_, sheep_t key)
+{
+	struct sheep_table *table = sheep_table(table_);
+	struct sheep_table_entry *entry;
+	unsigned int hole, index, home, mask;
+	unsigned long hash;
+
+	if (hash_key(vm, key, &hash))
+		return -1;
+
+	entry = lookup(table, key, hash);
+	if (!entry)
+		return 0;
+
+	/* Shift back what would be unreachable past the hole */
+	mask = table->size - 1;
+	hole = entry - table->entries;
+	for (index = (hole + 1) & mask; table->entries[index].key;
+	     index = (index + 1) & mask) {
+		home = table_index(table->entries[index].hash, mask);
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			table->entries[hole] = table->entries[index];
+			hole = index;
+		}
+	}
+	table->entries[hole].key = NULL;
+	table->nr_entries--;
+	return 1;
+}
+
+static void table_mark(sheep_t sheep)
+{
+	struct sheep_table *table;
+	unsigned int i;
+
+	table = sheep_table(sheep);
+	for (i = 0; i < table->size; i++) {
+		if (!table->entries[i].key)
+			continue;
+		sheep_mark(table->entries[i].key);
+		sheep_mark(table->entries[i].value);
+	}
+}
+
+static void table_free(struct sheep_vm *vm, sheep_t sheep)
+{
+	sheep_free(sheep_table(sheep)->entries);
+}
+
+static int table_test(sheep_t sheep)
+{
+	return sheep_table(sheep)->nr_entries != 0;
+}
+
+static int table_equal(sheep_t a, sheep_t b)
+{
+	struct sheep_table *ta, *tb;
+	unsigned int i;
+
+	ta = sheep_table(a);
+	tb = sheep_table(b);
+	if (ta->nr_entries != tb->nr_entries)
+		return 0;
+	for (i = 0; i < ta->size; i++) {
+		struct sheep_table_entry *entry = &ta->entries[i], *other;
+
+		if (!entry->key)
+			continue;
+		other = lookup(tb, entry->key, entry->hash);
+		if (!other || !sheep_equal(entry->value, other->value))
+			return 0;
+	}
+	return 1;
+}
+
+static void table_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
+{
+	struct sheep_table *table;
+	unsigned int i, nr = 0;
+
+	table = sheep_table(sheep);
+	sheep_strbuf_add(sb, "{");
+	for (i = 0; i < table->size; i++) {
+		if (!table->entries[i].key)
+			continue;
+		if (nr++)
+			sheep_strbuf_add(sb, ", ");
+		__sheep_format(table->entries[i].key, sb, 1);
+		sheep_strbuf_add(sb, " ");
+		__sheep_format(table->entries[i].value, sb, 1);
+	}
+	sheep_strbuf_add(sb, "}");
+}
+
+const struct sheep_type sheep_table_type = {
+	.name = "table",
+	.mark = table_mark,
+	.free = table_free,
+	.test = table_test,
+	.equal = table_equal,
+	.format = table_format,
+};
+
+sheep_t sheep_make_table(struct sheep_vm *vm)
+{
+	sheep_t sheep;
+
+	sheep = __sheep_make_object(vm, &sheep_table_type,
+				    sizeof(struct sheep_table));
+	memset(sheep_table(sheep), 0, sizeof(struct sheep_table));
+	return sheep;
+}
+
+/* (table &rest keys-and-values) */
+static sheep_t builtin_table(struct sheep_vm *vm, unsigned int nr_args)
+{
+	unsigned long base;
+	unsigned int i;
+	sheep_t table;
+
+	if (nr_args % 2) {
+		sheep_error(vm, "key without value");
+		return NULL;
+	}
+
+	/* The arguments stay on the stack until they are stored */
+	table = sheep_make_table(vm);
+	base = vm->stack.nr_items - nr_args;
+	for (i = 0; i < nr_args; i += 2)
+		if (sheep_table_set(vm, table, vm->stack.items[base + i],
+				    vm->stack.items[base + i + 1]))
+			return NULL;
+	vm->stack.nr_items = base;
+	return table;
+}
+
+/* (get table key &optional default) */
+static sheep_t builtin_get(struct sheep_vm *vm, unsigned int nr_args)
+{
+	sheep_t table, key, value = &sheep_nil;
+
+	if (nr_args == 3) {
+		value = sheep_vector_pop(&vm->stack);
+		nr_args--;
+	}
+	if (sheep_unpack_stack(vm, nr_args, "ho", &table, &key))
+		return NULL;
+	if (sheep_table_get(vm, table, key, &value) < 0)
+		return NULL;
+	return value;
+}
+
+/* (put table-or-vector key value) */
+static sheep_t builtin_put(struct sheep_vm *vm, unsigned int nr_args)
+{
+	sheep_t table, key, value;
+	long index;
+
+	if (sheep_unpack_stack(vm, nr_args, "ooo", &table, &key, &value))
+		return NULL;
+
+	if (sheep_type(table) == &sheep_array_type) {
+		if (sheep_unpack(vm, key, 'N', &index))
+			return NULL;
+		if (sheep_array_set(vm, table, index, value))
+			return NULL;
+		return value;
+	}
+
+	if (sheep_unpack(vm, table, 'h', &table))
+		return NULL;
+	if (sheep_table_set(vm, table, key, value))
+		return NULL;
+	return value;
+}
+
+/* (delete table key) */
+static sheep_t builtin_delete(struct sheep_vm *vm, unsigned int nr_args)
+{
+	sheep_t table, key;
+	int ret;
+
+	if (sheep_unpack_stack(vm, nr_args, "ho", &table, &key))
+		return NULL;
+	ret = sheep_table_del(vm, table, key);
+	if (ret < 0)
+		return NULL;
+	return ret ? &sheep_true : &sheep_false;
+}
+
+/* (keys table) */
+static sheep_t builtin_keys(struct sheep_vm *vm, unsigned int nr_args)
+{
+	struct sheep_table *table;
+	sheep_t table_, list, pos;
+	unsigned int i;
+
+	if (sheep_unpack_stack(vm, nr_args, "h", &table_))
+		return NULL;
+
+	sheep_protect(vm, table_);
+	list = pos = sheep_make_cons(vm, NULL, NULL);
+	sheep_protect(vm, list);
+
+	table = sheep_table(table_);
+	for (i = 0; i < table->size; i++)
+		if (table->entries[i].key)
+			pos = sheep_list_append(vm, pos, table->entries[i].key);
+
+	sheep_unprotect(vm, list);
+	sheep_unprotect(vm, table_);
+	return list;
+}
+
+void sheep_table_builtins(struct sheep_vm *vm)
+{
+	sheep_vm_function(vm, "table", builtin_table);
+	sheep_vm_function(vm, "get", builtin_get);
+	sheep_vm_function(vm, "put", builtin_put);
+	sheep_vm_function(vm, "delete", builtin_delete);
+	sheep_vm_function(vm, "keys", builtin_keys);
+}
@@ -4,6 +4,7 @@
  * Copyright (c) 2010 Johannes Weiner <hannes@cmpxchg.org>
  */
 #include <sheep/object.h>
+#include <sheep/code.h>
 #include <sheep/util.h>
 #include <sheep/map.h>
 #include <sheep/gc.h>
@@ -31,9 +32,8 @@ static void typeobject_free(struct sheep_vm *vm, sheep_t sheep)
 	struct sheep_typeobject *object;
 
 	object = sheep_data(sheep);
-	sheep_free(object->values);
-	sheep_map_drain(&object->map);
-	sheep_free(object);
+	if (object->values != (sheep_t *)(object + 1))
+		sheep_free(object->values);
 }
 
 static void typeobject_format(sheep_t sheep, struct sheep_strbuf *sb, int repr)
@@ -54,13 +54,11 @@ const struct sheep_type sheep_typeobject_type = {
 static void typeclass_free(struct sheep_vm *vm, sheep_t sheep)
 {
 	struct sheep_typeclass *class;
-	unsigned int i;
 
 	class = sheep_data(sheep);
 	sheep_free(class->name);
-	for (i = 0; i < class->nr_slots; i++)
-		sheep_free(class->names[i]);
 	sheep_free(class->names);
+	sheep_map_drain(&class->slots);
 	sheep_free(class);
 }
 
@@ -71,6 +69,8 @@ static enum sheep_call typeclass_call(struct sheep_vm *vm,
 {
 	struct sheep_typeobject *object;
 	struct sheep_typeclass *class;
+	size_t size;
+	sheep_t sheep;
 
 	class = sheep_data(callable);
 	if (nr_args != class->nr_slots) {
@@ -79,15 +79,23 @@ static enum sheep_call typeclass_call(struct sheep_vm *vm,
 		return SHEEP_CALL_FAIL;
 	}
 
-	object = sheep_zalloc(sizeof(struct sheep_typeobject));
+	/* The values stay on the stack until the object holds them */
+	size = sizeof(sheep_t) * nr_args;
+	if (sizeof(struct sheep_typeobject) + size <= SHEEP_INLINE_MAX) {
+		sheep = __sheep_make_object(vm, &sheep_typeobject_type,
+					sizeof(struct sheep_typeobject) + size);
+		object = sheep_data(sheep);
+		object->values = (sheep_t *)(object + 1);
+	} else {
+		sheep = __sheep_make_object(vm, &sheep_typeobject_type,
+					sizeof(struct sheep_typeobject));
+		object = sheep_data(sheep);
+		object->values = sheep_malloc(size);
+	}
 	object->class = callable;
-	object->values = sheep_malloc(sizeof(sheep_t *) * class->nr_slots);
-	while (nr_args--) {
+	while (nr_args--)
 		object->values[nr_args] = sheep_vector_pop(&vm->stack);
-		sheep_map_set(&object->map, class->names[nr_args],
-			(void *)(unsigned long)nr_args);
-	}
-	*valuep = sheep_make_object(vm, &sheep_typeobject_type, object);
+	*valuep = sheep;
 	return SHEEP_CALL_DONE;
 }
 
@@ -115,11 +123,15 @@ sheep_t sheep_make_typeclass(struct sheep_vm *vm,
 			     unsigned int nr_slots)
 {
 	struct sheep_typeclass *class;
+	unsigned int i;
 
-	class = sheep_malloc(sizeof(struct sheep_typeclass));
+	class = sheep_zalloc(sizeof(struct sheep_typeclass));
 	class->name = sheep_strdup(name);
 	class->names = names;
 	class->nr_slots = nr_slots;
+	for (i = 0; i < nr_slots; i++)
+		sheep_map_set(&class->slots, names[i], (void *)(unsigned long)i);
+	class->id = sheep_cache_id();
 
 	return sheep_make_object(vm, &sheep_typeclass_type, class);
 }
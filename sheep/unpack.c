@@ -4,11 +4,14 @@
  * Copyright (c) 2009 Johannes Weiner <hannes@cmpxchg.org>
  */
 #include <sheep/function.h>
+#include <sheep/flonum.h>
 #include <sheep/number.h>
 #include <sheep/object.h>
 #include <sheep/string.h>
+#include <sheep/table.h>
 #include <sheep/vector.h>
 #include <sheep/alien.h>
+#include <sheep/array.h>
 #include <sheep/bool.h>
 #include <sheep/list.h>
 #include <sheep/name.h>
@@ -40,6 +43,12 @@ static const char *unpack(int control,
 	case 'n':
 		if (type == &sheep_number_type)
 			break;
+		if (type == &sheep_bignum_type)
+			return "fixnum";
+		return "number";
+	case 'x':
+		if (sheep_is_number(object))
+			break;
 		return "number";
 	case 'a':
 		if (type == &sheep_name_type)
@@ -53,11 +62,21 @@ static const char *unpack(int control,
 		if (type == &sheep_list_type)
 			break;
 		return "list";
+	case 'h':
+		if (type == &sheep_table_type)
+			break;
+		return "table";
+	case 'v':
+		if (type == &sheep_array_type)
+			break;
+		return "vector";
 	case 'q':
 		if (type == &sheep_string_type)
 			break;
 		if (type == &sheep_list_type)
 			break;
+		if (type == &sheep_array_type)
+			break;
 		return "sequence";
 	case 'f':
 		if (type == &sheep_function_type)
@@ -89,6 +108,8 @@ static const char *unpack(int control,
 	else {
 		if (sheep_is_fixnum(object))
 			*itemp = (void *)sheep_fixnum(object);
+		else if (sheep_is_immediate(object))
+			*itemp = object;
 		else
 			*itemp = sheep_data(object);
 	}
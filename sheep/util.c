@@ -5,6 +5,7 @@
  */
 #include <sheep/config.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -44,6 +45,19 @@ void sheep_free(const void *mem)
 	free((void *)mem);
 }
 
+/* FNV-1a */
+unsigned long sheep_hash(const void *mem, size_t len)
+{
+	const unsigned char *bytes = mem;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		hash ^= *bytes++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
 void sheep_strbuf_addn(struct sheep_strbuf *sb, const char *str, size_t n)
 {
 	sb->bytes = sheep_realloc(sb->bytes, sb->nr_bytes + n + 1);
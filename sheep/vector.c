@@ -64,15 +64,21 @@ unsigned long sheep_vector_push(struct sheep_vector *vec, void *item)
 	return vec->nr_items++;
 }
 
+/*
+ * Vectors do not shrink on pop: the vm stack and call vectors go up
+ * and down all the time and would otherwise be reallocated over and
+ * over.
+ */
 void *sheep_vector_pop(struct sheep_vector *vec)
 {
-	void *item;
+	return vec->items[--vec->nr_items];
+}
 
-	vec->nr_items -= 1;
-	item = vec->items[vec->nr_items];
-	if (vec->nr_items && vec->nr_items < (vec->nr_alloc >> 3))
-		vector_resize(vec, vec->nr_items);
-	return item;
+/* Make room for @nr more items without another allocation */
+void sheep_vector_reserve(struct sheep_vector *vec, unsigned long nr)
+{
+	if (vec->nr_items + nr > vec->nr_alloc)
+		vector_resize(vec, vec->nr_items + nr);
 }
 
 void sheep_vector_grow(struct sheep_vector *vec, unsigned long delta)
@@ -8,11 +8,14 @@
 #include <sheep/number.h>
 #include <sheep/object.h>
 #include <sheep/string.h>
+#include <sheep/table.h>
 #include <sheep/alien.h>
+#include <sheep/array.h>
 #include <sheep/bool.h>
 #include <sheep/core.h>
 #include <sheep/eval.h>
 #include <sheep/list.h>
+#include <sheep/name.h>
 #include <sheep/type.h>
 #include <sheep/util.h>
 #include <sheep/gc.h>
@@ -48,6 +51,11 @@ void sheep_report_error(struct sheep_vm *vm, sheep_t sheep)
 {
 	sheep_bug_on(!vm->error);
 
+	if (vm->error_filename) {
+		fprintf(stderr, "%s:%lu: ", vm->error_filename,
+			vm->error_lineno);
+		vm->error_filename = NULL;
+	}
 	if (sheep) {
 		char *context;
 
@@ -62,34 +70,17 @@ void sheep_report_error(struct sheep_vm *vm, sheep_t sheep)
 }
 
 unsigned int sheep_vm_key(struct sheep_vm *vm, const char *key)
-{
-	unsigned int slot = 0;
-
-	if (vm->keys) {
-		while (vm->keys[slot]) {
-			if (!strcmp(vm->keys[slot], key))
-				return slot;
-			slot++;
-		}
-	}
-
-	vm->keys = sheep_realloc(vm->keys, sizeof(char *) * (slot + 2));
-	vm->keys[slot] = sheep_strdup(key);
-	vm->keys[slot + 1] = NULL;
-	return slot;
-}
-
-static void drain_keys(struct sheep_vm *vm)
 {
 	unsigned int slot;
+	void *entry;
 
-	if (!vm->keys)
-		return;
+	key = sheep_intern(vm, key);
+	if (!sheep_map_get(&vm->key_slots, key, &entry))
+		return (unsigned long)entry;
 
-	for (slot = 0; vm->keys[slot]; slot++)
-		sheep_free(vm->keys[slot]);
-
-	sheep_free(vm->keys);
+	slot = sheep_vector_push(&vm->keys, (void *)key);
+	sheep_map_set(&vm->key_slots, key, (void *)(unsigned long)slot);
+	return slot;
 }
 
 void sheep_vm_mark(struct sheep_vm *vm)
@@ -115,7 +106,8 @@ unsigned int sheep_vm_variable(struct sheep_vm *vm,
 	unsigned int slot;
 
 	slot = sheep_vm_constant(vm, value);
-	sheep_map_set(&vm->builtins, name, (void *)(unsigned long)slot);
+	sheep_map_set(&vm->builtins, sheep_intern(vm, name),
+		(void *)(unsigned long)slot);
 	return slot;
 }
 
@@ -126,17 +118,13 @@ void sheep_vm_function(struct sheep_vm *vm, const char *name, sheep_alien_t f)
 
 static void setup_argv(struct sheep_vm *vm, int ac, char **av)
 {
-	struct sheep_list *p;
-	sheep_t list;
+	sheep_t list, pos;
 
-	list = sheep_make_cons(vm, NULL, NULL);
+	list = pos = sheep_make_cons(vm, NULL, NULL);
 	sheep_protect(vm, list);
 
-	p = sheep_list(list);
 	while (ac--) {
-		p->head = sheep_make_string(vm, *av);
-		p->tail = sheep_make_cons(vm, NULL, NULL);
-		p = sheep_list(p->tail);
+		pos = sheep_list_append(vm, pos, sheep_make_string(vm, *av));
 		av++;
 	}
 
@@ -147,6 +135,7 @@ static void setup_argv(struct sheep_vm *vm, int ac, char **av)
 void sheep_vm_init(struct sheep_vm *vm, int ac, char **av)
 {
 	memset(vm, 0, sizeof(*vm));
+	sheep_gc_init(vm);
 	sheep_core_init(vm);
 	sheep_object_builtins(vm);
 	sheep_bool_builtins(vm);
@@ -154,17 +143,24 @@ void sheep_vm_init(struct sheep_vm *vm, int ac, char **av)
 	sheep_string_builtins(vm);
 	sheep_list_builtins(vm);
 	sheep_sequence_builtins(vm);
+	sheep_array_builtins(vm);
+	sheep_table_builtins(vm);
 	sheep_function_builtins(vm);
 	sheep_module_builtins(vm);
+	sheep_gc_builtins(vm);
 	setup_argv(vm, ac, av);
 }
 
 void sheep_vm_exit(struct sheep_vm *vm)
 {
+	sheep_map_drain(&vm->modules);
 	sheep_map_drain(&vm->builtins);
 	sheep_core_exit(vm);
 	sheep_evaluator_exit(vm);
 	sheep_free(vm->globals.items);
-	drain_keys(vm);
+	sheep_free(vm->main.globals.items);
+	sheep_map_drain(&vm->key_slots);
+	sheep_free(vm->keys.items);
 	sheep_gc_exit(vm);
+	sheep_symbols_exit(vm);
 }